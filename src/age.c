@@ -0,0 +1,179 @@
+/*
+ * File: page aging
+ * ---
+ * See age.h. Per env slot: a bitmap of the pages aging hid, and an age byte
+ * per 4KB page below ENV_VA_LIMIT (144KB), allocated the first time the slot
+ * is aged and kept with it, like the dirty bitmaps.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "mmu.h"
+#include "env.h"
+#include "vma.h"
+#include "age.h"
+
+#define PAGE(va)    ((va) / SM_PAGE_SIZE)
+#define N_PAGES     PAGE(ENV_VA_LIMIT)
+
+struct vm_age {
+    uint32_t hidden[N_PAGES / 32];
+    uint8_t age[N_PAGES];
+};
+
+// the top VM_AGE_WINDOW bits of an age: touched within the window.
+#define WINDOW_MASK ((0xffu << (8 - VM_AGE_WINDOW)) & 0xff)
+
+static inline int bit_get(uint32_t *m, unsigned i) {
+    return m[i / 32] >> (i % 32) & 1;
+}
+
+// set or clear bits [i, i+n).
+static void bits_wr(uint32_t *m, unsigned i, unsigned n, int v) {
+    while (n) {
+        unsigned k = 32 - i % 32 < n ? 32 - i % 32 : n;
+        uint32_t mask = (k == 32 ? ~0u : (1u << k) - 1) << (i % 32);
+        if (v)
+            m[i / 32] |= mask;
+        else
+            m[i / 32] &= ~mask;
+        i += k;
+        n -= k;
+    }
+}
+
+static uint32_t next_va(uint32_t va, unsigned sz) {
+    return (va & ~(sz - 1)) + sz;
+}
+
+// AP of a mapping, keeping everything else (APX in particular).
+static void set_ap(env_t *e, uint32_t va, int flags, unsigned ap) {
+    mmu_protect(e->pt, va, (flags & ~0b111) | ap);
+}
+
+// mmu_protect only drops TLB entries under the running ASID: an env that
+// isn't running would reach hidden pages through its old ones, unseen.
+static void age_flush(env_t *e) {
+    if (e != curr_env)
+        cp15_tlb_inv_asid(e->asid);
+}
+
+void vm_age_start(env_t *e) {
+    if (!e->age)
+        e->age = kmalloc(sizeof *e->age);
+    memset(e->age, 0, sizeof *e->age);
+    e->age_on = 1;
+    e->wss = 0;
+}
+
+void vm_age_release(env_t *e) {
+    if (!e->age_on)
+        return;
+    uint32_t *h = e->age->hidden;
+    unsigned n = 0;
+    for (unsigned w = 0; w < N_PAGES / 32; w++)
+        while (h[w]) {
+            uint32_t va = (w * 32 + __builtin_ctz(h[w])) * SM_PAGE_SIZE, pa;
+            int flags;
+            unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+            // swapped out (swap.c): nothing to give back.
+            if (!sz) {
+                bits_wr(h, PAGE(va), 1, 0);
+                continue;
+            }
+            demand((flags & 0b111) == F_NO_USR_ACCESS, hidden page lost its AP);
+            set_ap(e, va, flags, F_FULL_ACCESS);
+            bits_wr(h, PAGE(va & ~(sz - 1)), sz / SM_PAGE_SIZE, 0);
+            n++;
+        }
+    if (n)
+        age_flush(e);
+}
+
+void vm_age_stop(env_t *e) {
+    vm_age_release(e);
+    e->age_on = 0;
+}
+
+// age the mapping covering va and hide it; returns its size (4KB if unmapped)
+// and adds it to *wss if it is in the working set.
+static unsigned age_one(env_t *e, uint32_t va, uint32_t *wss) {
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    if (!sz || !FGET_NG(flags))
+        return sz ? sz : SM_PAGE_SIZE;
+
+    unsigned first = PAGE(va & ~(sz - 1)), n = sz / SM_PAGE_SIZE;
+    unsigned touched;
+    if (bit_get(e->age->hidden, first))
+        touched = 0;
+    else if ((flags & 0b111) == F_FULL_ACCESS)
+        touched = 1;
+    else
+        return sz;  // not ours to hide (a no-user region)
+
+    uint8_t *a = &e->age->age[first];
+    for (unsigned i = 0; i < n; i++)
+        a[i] = a[i] >> 1 | touched << 7;
+    if (a[0] & WINDOW_MASK)
+        *wss += sz;
+
+    if (touched) {
+        set_ap(e, va, flags, F_NO_USR_ACCESS);
+        bits_wr(e->age->hidden, first, n, 1);
+    }
+    return sz;
+}
+
+uint32_t vm_age_scan(env_t *e) {
+    demand(e->age_on, env is not aged);
+
+    uint32_t wss = 0;
+    for (unsigned i = 0; i < e->n_vma; i++) {
+        vma_t *v = &e->vma[i];
+        if (v->type == VMA_DEVICE || !v->committed)
+            continue;
+        for (uint32_t va = v->start; va < v->end; ) {
+            if (!mmu_lookup(e->pt, va))
+                va = next_va(va, SECTION_SIZE);
+            else
+                va = next_va(va, age_one(e, va, &wss));
+        }
+    }
+    age_flush(e);
+    return e->wss = wss;
+}
+
+int vm_age_fault(env_t *e, uint32_t va) {
+    if (!e->age_on || va >= ENV_VA_LIMIT || !bit_get(e->age->hidden, PAGE(va)))
+        return 0;
+
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    demand(sz && (flags & 0b111) == F_NO_USR_ACCESS, hidden page lost its AP);
+    bits_wr(e->age->hidden, PAGE(va & ~(sz - 1)), sz / SM_PAGE_SIZE, 0);
+    set_ap(e, va, flags, F_FULL_ACCESS);
+    return 1;
+}
+
+unsigned vm_age_of(env_t *e, uint32_t va) {
+    if (!e->age_on || va >= ENV_VA_LIMIT)
+        return 0;
+    return e->age->age[PAGE(va)];
+}
+
+int vm_age_cold(env_t *e, uint32_t va) {
+    if (!e->age_on || va >= ENV_VA_LIMIT)
+        return 0;
+    unsigned i = PAGE(va);
+    return bit_get(e->age->hidden, i) && !(e->age->age[i] & WINDOW_MASK);
+}
+
+int vm_age_hidden(env_t *e, uint32_t va) {
+    return e->age_on && va < ENV_VA_LIMIT && bit_get(e->age->hidden, PAGE(va));
+}
+
+uint32_t vm_age_wss(env_t *e) {
+    return e->age_on ? e->wss : 0;
+}
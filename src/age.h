@@ -0,0 +1,54 @@
+#ifndef __AGE_H__
+#define __AGE_H__
+
+/*
+ * Page aging and working set estimate
+ * ---
+ * ARMv6 has no accessed bit either, so references are sampled with faults.
+ * Each vm_age_scan hides every committed user page of the env (ANON, HEAP and
+ * STACK regions) from user mode by setting its AP to privileged-only (APX is
+ * kept, so COW and dirty tracking still work after it comes back). The next
+ * user access takes a permission fault, and vm_age_fault gives the page its
+ * access back. A page that is still hidden at the next scan was not touched
+ * during that period.
+ *
+ * Every 4KB page has an 8-bit age, shifted right once per scan, with bit 7 set
+ * if the page was touched in the period that just ended (the "aging"
+ * approximation of LRU). A replacement policy evicts the smallest ages first.
+ * The working set is the pages touched in the last VM_AGE_WINDOW periods. The
+ * kernel's own accesses don't count, since they don't fault.
+ *
+ * Hidden pages must get their access back (vm_age_release) before their
+ * descriptors are copied or torn down: env_fork and env_free do it. A release
+ * counts as a touch at the next scan, so after a fork the estimate errs high.
+ */
+#include "env.h"
+
+#define VM_AGE_WINDOW   4   // periods a page stays in the working set
+
+// start aging <e>: all ages 0, and the first scan sees every page touched.
+void vm_age_start(env_t *e);
+// stop: hidden pages get their access back.
+void vm_age_stop(env_t *e);
+// give hidden pages their access back but keep aging.
+void vm_age_release(env_t *e);
+
+// end a period: age every committed page, hide them all again and return the
+// working set estimate in bytes. call it from a timer, every 10-100ms.
+uint32_t vm_age_scan(env_t *e);
+
+// a user permission fault at <va>: 1 if the page was hidden by aging (it is
+// back: retry the access), 0 otherwise.
+int vm_age_fault(env_t *e, uint32_t va);
+
+// age of the page at <va> (0 if <e> isn't aged).
+unsigned vm_age_of(env_t *e, uint32_t va);
+// 1 if the page at <va> has not been touched since the last scan nor in the
+// VM_AGE_WINDOW periods before it: a candidate for eviction.
+int vm_age_cold(env_t *e, uint32_t va);
+// 1 if aging has the page at <va> hidden.
+int vm_age_hidden(env_t *e, uint32_t va);
+// the estimate of the last scan.
+uint32_t vm_age_wss(env_t *e);
+
+#endif
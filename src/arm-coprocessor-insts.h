@@ -62,6 +62,14 @@
  */
 #define CLEAN_INV_DCACHE(Rd)    mcr p15, 0, Rd, c7, c14, 0  
 #define INV_DCACHE(Rd)          mcr p15, 0, Rd, c7, c6, 0  
+#define CLEAN_DCACHE(Rd)        mcr p15, 0, Rd, c7, c10, 0
+
+/* b6-19: single line operations, Rd = MVA of the line. */
+#define CLEAN_DCACHE_MVA(Rd)    mcr p15, 0, Rd, c7, c10, 1
+#define INV_DCACHE_MVA(Rd)      mcr p15, 0, Rd, c7, c6, 1
+#define CLEAN_INV_DCACHE_MVA(Rd) mcr p15, 0, Rd, c7, c14, 1
+// the icache bug above is in the invalidate-all; by MVA is fine.
+#define INV_ICACHE_MVA(Rd)      mcr p15, 0, Rd, c7, c5, 1
 
 
 // Note: I'm inclined to believe the icache bug above effects the arm invalidate
@@ -75,9 +83,6 @@
  * control tlbs.  this is a subset.
  * read b2-22: TLB maintance operations and the memory order model.
  *
- * there are other functions, such as invalidate asid and invalidate
- * a single entry.  we may do later.
- *
  * i think we have to invalidate the BTB and Prefetch if doing these.
  */
 
@@ -85,6 +90,34 @@
 #define INV_DTLB(Rd)        mcr p15, 0, Rd, c8, c6, 0 
 /* invalidate unified TLB or both I/D TLB */
 #define INV_TLB(Rd)         mcr p15, 0, Rd, c8, c7, 0
+/* 
+ * invalidate a single unified entry: Rd = MVA[31:12] | ASID[7:0].  the ASID
+ * only has to match for non-global entries.
+ */
+#define INV_TLB_MVA(Rd)     mcr p15, 0, Rd, c8, c7, 1
+/* invalidate every non-global unified entry with ASID = Rd[7:0] */
+#define INV_TLB_ASID(Rd)    mcr p15, 0, Rd, c8, c7, 2
+
+/*
+ * VA to PA translation (c7, arm1176.pdf): walk Rd = VA as a privileged or user
+ * read or write from the current context would, domain and permission checks
+ * included, and leave the result in the PA register.  no memory access is
+ * made.  PA register: PA[31:10] if bit 0 is clear, else the fault status
+ * FSR[10,3:0] in [5:1].
+ */
+#define VA_TO_PA_PRIV_RD(Rd)    mcr p15, 0, Rd, c7, c8, 0
+#define VA_TO_PA_PRIV_WR(Rd)    mcr p15, 0, Rd, c7, c8, 1
+#define VA_TO_PA_USER_RD(Rd)    mcr p15, 0, Rd, c7, c8, 2
+#define VA_TO_PA_USER_WR(Rd)    mcr p15, 0, Rd, c7, c8, 3
+#define PA_REG_RD(Rd)           mrc p15, 0, Rd, c7, c4, 0
+
+/*
+ * TLB lockdown register (c10, arm1176.pdf).  Rd = victim[28:26] | P[0].  while P=1
+ * every page table walk loads its result into lockable entry <victim> of the
+ * main TLB, where INV_TLB will not touch it.  INV_TLB_MVA does.
+ */
+#define TLB_LOCKDOWN_RD(Rd)     mrc p15, 0, Rd, c10, c0, 0
+#define TLB_LOCKDOWN_WR(Rd)     mcr p15, 0, Rd, c10, c0, 0
 
 /*
  * 3-61 in arm1176.pdf
@@ -114,6 +147,15 @@
 #define CONTROL_REG1_RD(Rd) mrc p15, 0, Rd, c1, c0, 0
 #define CONTROL_REG1_WR(Rd) mcr p15, 0, Rd, c1, c0, 0
 
+/*
+ * performance monitor control (PMNC) and cycle counter (c15, arm1176.pdf).
+ * PMNC bit 0 enables the counters, bit 2 resets the cycle counter, bit 3 makes
+ * it count every 64th cycle.
+ */
+#define PMNC_RD(Rd)             mrc p15, 0, Rd, c15, c12, 0
+#define PMNC_WR(Rd)             mcr p15, 0, Rd, c15, c12, 0
+#define CYCLE_CNT_RD(Rd)        mrc p15, 0, Rd, c15, c12, 1
+
 /*
  * many things not implemented: fault status, b4-43, watch point b4-44.  
  * we will do later.
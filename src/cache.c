@@ -0,0 +1,70 @@
+/*
+ * File: range cache maintenance
+ * ---
+ * See cache.h. The line loops are in vm-asm.S; this picks between them and
+ * the whole-cache operations, and deals with partly covered lines.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "cache.h"
+
+static inline int too_big(const void *start, const void *end) {
+    return (uintptr_t)end - (uintptr_t)start > CACHE_RANGE_MAX;
+}
+
+void cache_clean_range(const void *start, const void *end) {
+    if (start >= end)
+        return;
+    if (too_big(start, end))
+        cp15_dcache_clean();
+    else
+        cp15_dcache_clean_lines(start, end);
+}
+
+void cache_clean_inv_range(const void *start, const void *end) {
+    if (start >= end)
+        return;
+    if (too_big(start, end))
+        cp15_dcache_clean_inv();
+    else
+        cp15_dcache_clean_inv_lines(start, end);
+}
+
+void cache_inv_range(void *start, void *end) {
+    if (start >= end)
+        return;
+    if (too_big(start, end)) {
+        cp15_dcache_clean_inv();
+        return;
+    }
+
+    // [lo, hi) is the lines the range covers whole.
+    uintptr_t s = (uintptr_t)start, e = (uintptr_t)end;
+    uintptr_t lo = (s + CACHE_LINE - 1) & ~(CACHE_LINE - 1),
+              hi = e & ~(CACHE_LINE - 1);
+    if (lo >= hi) {
+        // one or two lines, neither covered whole.
+        cp15_dcache_clean_inv_lines(start, end);
+        return;
+    }
+    if (s < lo)
+        cp15_dcache_clean_inv_lines(start, (void *)lo);
+    if (hi < e)
+        cp15_dcache_clean_inv_lines((void *)hi, end);
+    cp15_dcache_inv_lines((void *)lo, (void *)hi);
+}
+
+void cache_icache_inv_range(const void *start, const void *end) {
+    if (start >= end)
+        return;
+    if (too_big(start, end))
+        cp15_icache_inv();
+    else
+        cp15_icache_inv_lines(start, end);
+}
+
+void cache_sync_code(const void *start, const void *end) {
+    // the clean's DSB orders it before the I-cache invalidate.
+    cache_clean_range(start, end);
+    cache_icache_inv_range(start, end);
+}
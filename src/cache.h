@@ -0,0 +1,36 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+/*
+ * Cache maintenance over address ranges
+ * ---
+ * The whole-cache operations (cp15_dcache_clean_inv, cp15_icache_inv) walk
+ * every line and throw away the hot ones with the stale. These walk just the
+ * 32-byte lines of [start, end) by MVA (pg. B6-19), and switch to the
+ * whole-cache operation once the range is bigger than CACHE_RANGE_MAX, where
+ * going line by line costs more than the cache holds. Addresses are the
+ * current virtual ones; the caches are physically tagged, so any alias works.
+ *
+ * What each is for:
+ *  - clean: CPU writes must reach memory before something that doesn't look
+ *    in the cache reads them: a DMA engine, or the table walk (mmu.c).
+ *  - inv: something other than the CPU wrote memory (DMA in), and the cache
+ *    may hold the old contents. A line the range only partly covers is
+ *    cleaned first, so other data sharing it isn't lost; the whole-cache
+ *    fallback is clean+invalidate for the same reason.
+ *  - sync_code: the range now holds instructions (a loaded program): clean
+ *    them out of the D-cache, then drop old ones from the I-cache, the BTB
+ *    and the prefetch buffer.
+ */
+
+#define CACHE_LINE      32
+#define CACHE_SIZE      (16 * 1024) // each of the arm1176's I- and D-caches
+#define CACHE_RANGE_MAX CACHE_SIZE
+
+void cache_clean_range(const void *start, const void *end);
+void cache_inv_range(void *start, void *end);
+void cache_clean_inv_range(const void *start, const void *end);
+void cache_icache_inv_range(const void *start, const void *end);
+void cache_sync_code(const void *start, const void *end);
+
+#endif
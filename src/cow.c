@@ -0,0 +1,175 @@
+/*
+ * File: copy-on-write
+ * ---
+ * Table cloning for env_fork and the write-fault side of COW. See cow.h for
+ * the protocol.
+ */
+#include "rpi.h"
+#include "mmu.h"
+#include "pt-alloc.h"
+#include "cow.h"
+#include "frame.h"
+
+static uint8_t *refs;
+static unsigned n_frames;
+static cow_stats_t stats;
+
+// saturated counts stick: the frame is copied on every write from then on.
+#define REF_MAX 255
+
+void cow_init(uint32_t ram_bytes) {
+    n_frames = ram_bytes / SM_PAGE_SIZE;
+    refs = kmalloc(n_frames);
+    memset(&stats, 0, sizeof stats);
+}
+
+// reference count for the frame at pa; 0 if we don't track it.
+static uint8_t *cow_ref(uint32_t pa) {
+    unsigned i = pa / SM_PAGE_SIZE;
+    return i < n_frames ? &refs[i] : 0;
+}
+
+// a fork is sharing this mapping: count it and return 1 if it must be write
+// protected. writable user mappings become shared; already-shared ones gain a
+// sharer; anything else (global, genuinely read-only, untracked) is copied as is.
+static int cow_share(unsigned nG, unsigned ap, unsigned apx, uint32_t pa) {
+    uint8_t *r = cow_ref(pa);
+    if(!nG || ap != AP_FULL_ACCESS || !r)
+        return 0;
+    if(apx && !*r)
+        return 0;
+
+    if(!*r)
+        *r = 2;
+    else if(*r < REF_MAX)
+        (*r)++;
+    stats.n_shared++;
+    return 1;
+}
+
+// the table holding this mapping is going away: drop its share, and once no
+// env maps the memory give any frames behind it back to frame.c.
+static void cow_unshare(unsigned nG, unsigned ap, unsigned apx, uint32_t pa, uint32_t sz) {
+    if(!nG)
+        return;
+    uint8_t *r = cow_ref(pa);
+    if(ap == AP_FULL_ACCESS && apx && r && *r && *r < REF_MAX)
+        (*r)--;
+    if(!r || !*r)
+        frame_release(pa, sz);
+}
+
+static sld_t *coarse_table(fld_t *pde) {
+    return mmu_pa_to_ptr(((coarse_pt_desc_t *)pde)->base << 10);
+}
+
+// write-protect the shared entries of coarse table src, then copy it to dst.
+static void clone_coarse(sld_t *dst, sld_t *src) {
+    int shared = 0;
+    for(unsigned j = 0; j < 256; j++) {
+        if(src[j].tag1 == SLD_SM_PAGE_BIT_1) {
+            sm_page_desc_t *p = (void *)&src[j];
+            if(cow_share(p->nG, p->AP, p->APX, p->base << 12))
+                p->APX = 1;
+        } else if(src[j].tag0) {
+            // large page: count once, protect all 16 replicas.
+            lg_page_desc_t *p = (void *)&src[j];
+            if(j % 16 == 0)
+                shared = cow_share(p->nG, p->AP, p->APX, p->base << 16);
+            if(shared)
+                p->APX = 1;
+        }
+    }
+    memcpy(dst, src, PT_COARSE_SIZE);
+}
+
+void cow_clone_pt(fld_t *dst, fld_t *src, unsigned n, unsigned from, unsigned to) {
+    for(unsigned i = 0; i < n; i++) {
+        // already set in dst: the kernel's entries, linked by env_alloc.
+        if(dst[i].tag)
+            continue;
+        if(src[i].tag == FLD_SECTION_TAG) {
+            sec_desc_t *s = (void *)&src[i];
+            // supersections: bits 5-8 are base address, not a domain.
+            if(s->super) {
+                dst[i] = src[i];
+                continue;
+            }
+            if(cow_share(s->nG, s->AP, s->APX, s->sec_base_addr << 20))
+                s->APX = 1;
+            dst[i] = src[i];
+        } else if(src[i].tag == FLD_COARSE_PT_TAG) {
+            sld_t *t = pt_coarse_alloc();
+            clone_coarse(t, coarse_table(&src[i]));
+            dst[i] = src[i];
+            ((coarse_pt_desc_t *)&dst[i])->base = mmu_ptr_to_pa(t) >> 10;
+        } else
+            continue;
+
+        if(dst[i].domain == from)
+            dst[i].domain = to;
+    }
+    // src's shared entries lost write access behind mmu.c's back.
+    mmu_xlate_inval();
+}
+
+void cow_release_pt(fld_t *pt, unsigned n) {
+    for(unsigned i = 0; i < n; i++) {
+        if(pt[i].tag == FLD_SECTION_TAG) {
+            sec_desc_t *s = (void *)&pt[i];
+            if(!s->super)
+                cow_unshare(s->nG, s->AP, s->APX, s->sec_base_addr << 20, SECTION_SIZE);
+        } else if(pt[i].tag == FLD_COARSE_PT_TAG) {
+            sld_t *t = coarse_table(&pt[i]);
+            for(unsigned j = 0; j < 256; j++) {
+                if(t[j].tag1 == SLD_SM_PAGE_BIT_1) {
+                    sm_page_desc_t *p = (void *)&t[j];
+                    cow_unshare(p->nG, p->AP, p->APX, p->base << 12, SM_PAGE_SIZE);
+                } else if(t[j].tag0 && j % 16 == 0) {
+                    lg_page_desc_t *p = (void *)&t[j];
+                    cow_unshare(p->nG, p->AP, p->APX, p->base << 16, LG_PAGE_SIZE);
+                }
+            }
+        }
+    }
+}
+
+int cow_fault(fld_t *pt, uint32_t va) {
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(pt, va, &pa, &flags);
+
+    int cow = F_NOT_GLOBAL | F_SET_APX | F_FULL_ACCESS;
+    if(!sz || sz == SUPERSECTION_SIZE || (flags & cow) != cow)
+        return 0;
+    uint8_t *r = cow_ref(pa);
+    if(!r || !*r)
+        return 0;
+
+    if(*r == 1) {
+        // everyone else wrote (and copied) already: the frame is ours.
+        *r = 0;
+        stats.n_reused++;
+    } else {
+        uint32_t copy = frame_alloc(sz);
+        if(!copy)
+            return 0;
+        memcpy(frame_kmap(copy, sz), mmu_va_to_ptr(va & ~(sz - 1), pa), sz);
+        frame_kunmap();
+        mmu_remap(pt, va, copy);
+        if(*r < REF_MAX)
+            (*r)--;
+        stats.n_copied++;
+    }
+    mmu_protect(pt, va, flags & ~F_SET_APX);
+    return 1;
+}
+
+unsigned cow_sharers(uint32_t pa) {
+    uint8_t *r = cow_ref(pa);
+    return r ? *r : 0;
+}
+
+cow_stats_t cow_stats(void) {
+    return stats;
+}
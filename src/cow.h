@@ -0,0 +1,51 @@
+#ifndef __COW_H__
+#define __COW_H__
+
+/*
+ * Copy-on-write sharing between envs
+ * ---
+ * env_fork copies the parent's page tables but not its memory: every writable,
+ * non-global (user) mapping is made read-only in both envs by setting APX with
+ * AP=0b11 (read-only for user and kernel alike, pg. B4-9), and the frame gets a
+ * reference count. The first write from either side takes a page permission
+ * fault; cow_fault then copies the frame into a new one from frame.c (or, if
+ * it was the last sharer, just makes the page writable again) and the access
+ * is retried.
+ *
+ * Reference counts are one byte per 4KB frame of RAM; a 64KB page or section
+ * is counted at its first frame. A count of 0 means "not shared", so genuinely
+ * read-only pages never look like COW pages.
+ */
+#include "mmu.h"
+
+// frames above this are not tracked: mappings of them are shared writable.
+#define COW_RAM_SIZE    (256 * 1024 * 1024)
+
+void cow_init(uint32_t ram_bytes);
+
+// copy the first <n> descriptors of src into dst, moving entries in domain
+// <from> to domain <to> and write-protecting shared user memory in both.
+// coarse tables are copied; entries dst already has (the kernel's) are left
+// alone. the caller flushes src's stale TLB entries.
+void cow_clone_pt(fld_t *dst, fld_t *src, unsigned n, unsigned from, unsigned to);
+
+// resolve a write fault at <va> in <pt>. returns 1 if it was a COW page
+// (retry the access), 0 if the fault is someone else's problem.
+int cow_fault(fld_t *pt, uint32_t va);
+
+// drop the references held by pt's first <n> entries before it is freed, and
+// free the frames (frame.c) of user mappings no other env shares.
+void cow_release_pt(fld_t *pt, unsigned n);
+
+// envs sharing the frame at <pa> copy-on-write; 0 if none (or not tracked).
+unsigned cow_sharers(uint32_t pa);
+
+typedef struct {
+    unsigned n_shared,  // frames write-protected by a fork
+             n_copied,  // write faults that copied a frame
+             n_reused;  // write faults by the last sharer: no copy
+} cow_stats_t;
+
+cow_stats_t cow_stats(void);
+
+#endif
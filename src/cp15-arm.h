@@ -151,6 +151,15 @@ uint32_t cp15_cache_type_rd(void);
 uint32_t cp15_domain_ctrl_rd(void);
 void cp15_domain_ctrl_wr(uint32_t d);
 
+// performance monitor control (c15): see PMNC_* in arm-coprocessor-insts.h.
+#define PMNC_ENABLE         (1 << 0)
+#define PMNC_CYCLE_RESET    (1 << 2)
+#define PMNC_CYCLE_DIV64    (1 << 3)
+uint32_t cp15_pmnc_rd(void);
+void cp15_pmnc_wr(uint32_t r);
+// free-running cycle counter: counts once PMNC_ENABLE is set, wraps at 2^32.
+uint32_t cp15_cycle_cnt_rd(void);
+
 /*********************************************************************************
  * simple cache enable/disable routines.
  */
@@ -160,8 +169,17 @@ void cp15_domain_ctrl_wr(uint32_t d);
 void cp15_icache_inv(void);
 void cp15_dcache_inv(void);
 void cp15_dcache_clean_inv(void);
+void cp15_dcache_clean(void);
 void cp15_caches_inv(void);
 
+// the same by MVA, every 32-byte line overlapping [start, end) (vm-asm.S). end
+// must be past start. cache.h wraps these with the whole-cache fallback.
+void cp15_dcache_clean_lines(const void *start, const void *end);
+void cp15_dcache_inv_lines(const void *start, const void *end);
+void cp15_dcache_clean_inv_lines(const void *start, const void *end);
+// + BTB and prefetch flush: the range holds new instructions.
+void cp15_icache_inv_lines(const void *start, const void *end);
+
 void cp15_dsb(void);
 void cp15_dmb(void);
 
@@ -173,6 +191,34 @@ void cp15_tlbs_inv(void);
 void cp15_dtlb_inv(void);
 void cp15_itlb_inv(void);
 
+// invalidate the one TLB entry holding <mva>.  bits 7:0 are the ASID, which
+// only has to match for non-global entries (b4-45).
+void cp15_tlb_inv_mva(uint32_t mva);
+// invalidate all non-global TLB entries tagged with <asid>.
+void cp15_tlb_inv_asid(uint32_t asid);
+
+// TLB lockdown register (c10): victim[28:26] | P[0].  see tlb-lock.h.
+uint32_t cp15_tlb_lockdown_rd(void);
+void cp15_tlb_lockdown_wr(uint32_t r);
+// walk <mva> into lockable entry <victim>, interrupts off (vm-asm.S).
+void cp15_tlb_lock_mva(uint32_t mva, unsigned victim);
+
+// c7 VA to PA translation (vm-asm.S): the hardware walk of <va> in the current
+// context for a privileged or user read or write. returns the PA register.
+#define HW_XLATE_PRIV   0
+#define HW_XLATE_USER   2
+#define HW_XLATE_READ   0
+#define HW_XLATE_WRITE  1
+uint32_t mmu_hw_translate(uint32_t va, unsigned mode, unsigned rw);
+
+// decoding the PA register: on an abort, the fault status in the same
+// encoding as WFAULT_STATUS (pg. B4-20); otherwise the pa of <va>.
+#define HW_XLATE_ABORTED(par)   ((par) & 1)
+#define HW_XLATE_STATUS(par)    (((par) >> 1 & 0xF) | ((par) >> 5 & 1) << 4)
+static inline uint32_t hw_xlate_pa(uint32_t par, uint32_t va) {
+    return (par & ~0x3FFu) | (va & 0x3FF);
+}
+
 void cp15_btb_flush(void);
 void cp15_prefetch_flush(void);
 
@@ -0,0 +1,177 @@
+/*
+ * File: dirty page tracking
+ * ---
+ * See dirty.h. e->dirty holds the dirty bitmap followed by the write-protected
+ * one. It is allocated the first time an env slot is tracked and kept with
+ * the slot, since kmalloc memory isn't given back.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "mmu.h"
+#include "env.h"
+#include "vma.h"
+#include "dirty.h"
+
+#define PAGE(va)    ((va) / SM_PAGE_SIZE)
+
+static uint32_t *wp_bits(env_t *e) {
+    return e->dirty + VM_DIRTY_WORDS;
+}
+
+static inline int bit_get(uint32_t *m, unsigned i) {
+    return m[i / 32] >> (i % 32) & 1;
+}
+
+// set or clear bits [i, i+n).
+static void bits_wr(uint32_t *m, unsigned i, unsigned n, int v) {
+    while (n) {
+        unsigned k = 32 - i % 32 < n ? 32 - i % 32 : n;
+        uint32_t mask = (k == 32 ? ~0u : (1u << k) - 1) << (i % 32);
+        if (v)
+            m[i / 32] |= mask;
+        else
+            m[i / 32] &= ~mask;
+        i += k;
+        n -= k;
+    }
+}
+
+// write-protect the mapping covering va if it is a writable user mapping, and
+// remember that we did. returns its size (4KB if unmapped), to step over it.
+// a page aging hid from the user (age.h) is still writable: it gets APX too,
+// and keeps it when the user's next touch gives it back.
+static unsigned protect(env_t *e, uint32_t va) {
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    if (!sz)
+        return SM_PAGE_SIZE;
+    unsigned ap = flags & 0b111;
+    if ((flags & (F_NOT_GLOBAL | F_SET_APX)) == F_NOT_GLOBAL
+    && (ap == F_FULL_ACCESS || ap == F_NO_USR_ACCESS)) {
+        mmu_protect(e->pt, va, flags | F_SET_APX);
+        bits_wr(wp_bits(e), PAGE(va & ~(sz - 1)), sz / SM_PAGE_SIZE, 1);
+    }
+    return sz;
+}
+
+// mmu_protect only drops TLB entries under the running ASID: an env that
+// isn't running could keep writing through its old ones.
+static void dirty_flush(env_t *e) {
+    if (e != curr_env)
+        cp15_tlb_inv_asid(e->asid);
+}
+
+// next mapping after the one of <sz> bytes covering va.
+static uint32_t next_va(uint32_t va, unsigned sz) {
+    return (va & ~(sz - 1)) + sz;
+}
+
+void vm_dirty_track(env_t *e) {
+    if (!e->dirty)
+        e->dirty = kmalloc(2 * VM_DIRTY_WORDS * sizeof *e->dirty);
+    memset(e->dirty, 0, 2 * VM_DIRTY_WORDS * sizeof *e->dirty);
+    e->dirty_on = 1;
+
+    for (unsigned i = 0; i < e->n_vma; i++) {
+        vma_t *v = &e->vma[i];
+        if (v->type == VMA_DEVICE)
+            continue;
+        for (uint32_t va = v->start; va < v->end; ) {
+            // nothing committed in this MB.
+            if (!mmu_lookup(e->pt, va))
+                va = next_va(va, SECTION_SIZE);
+            else
+                va = next_va(va, protect(e, va));
+        }
+    }
+    dirty_flush(e);
+}
+
+void vm_dirty_release(env_t *e) {
+    if (!e->dirty_on)
+        return;
+    uint32_t *wp = wp_bits(e);
+    unsigned n = 0;
+    for (unsigned w = 0; w < VM_DIRTY_WORDS; w++)
+        while (wp[w]) {
+            uint32_t va = (w * 32 + __builtin_ctz(wp[w])) * SM_PAGE_SIZE, pa;
+            int flags;
+            unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+            // swapped out (swap.c): nothing to give back.
+            if (!sz) {
+                bits_wr(wp, PAGE(va), 1, 0);
+                continue;
+            }
+            demand(flags & F_SET_APX, tracked page lost its protection);
+            mmu_protect(e->pt, va, flags & ~F_SET_APX);
+            bits_wr(wp, PAGE(va & ~(sz - 1)), sz / SM_PAGE_SIZE, 0);
+            n++;
+        }
+    if (n)
+        dirty_flush(e);
+}
+
+void vm_dirty_untrack(env_t *e) {
+    vm_dirty_release(e);
+    e->dirty_on = 0;
+}
+
+int vm_dirty_fault(env_t *e, uint32_t va) {
+    if (!e->dirty_on || va >= ENV_VA_LIMIT || !bit_get(wp_bits(e), PAGE(va)))
+        return 0;
+
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    demand(sz && (flags & F_SET_APX), tracked page lost its protection);
+    unsigned first = PAGE(va & ~(sz - 1)), n = sz / SM_PAGE_SIZE;
+    bits_wr(wp_bits(e), first, n, 0);
+    bits_wr(e->dirty, first, n, 1);
+    mmu_protect(e->pt, va, flags & ~F_SET_APX);
+    return 1;
+}
+
+void vm_dirty_mark(env_t *e, uint32_t va) {
+    if (!e->dirty_on || va >= ENV_VA_LIMIT)
+        return;
+    vma_t *v = vma_lookup(e, va);
+    if (!v || v->type == VMA_DEVICE)
+        return;
+
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    if (sz)
+        bits_wr(e->dirty, PAGE(va & ~(sz - 1)), sz / SM_PAGE_SIZE, 1);
+}
+
+int vm_dirty_protected(env_t *e, uint32_t va) {
+    return e->dirty_on && va < ENV_VA_LIMIT && bit_get(wp_bits(e), PAGE(va));
+}
+
+unsigned vm_dirty_collect(env_t *e, uint32_t *out) {
+    demand(e->dirty_on, env is not tracked);
+    if (out)
+        memcpy(out, e->dirty, VM_DIRTY_WORDS * sizeof *out);
+
+    // counted before protecting: clearing a section's or large page's bits
+    // runs on into words the loop below then skips.
+    unsigned n = 0;
+    for (unsigned w = 0; w < VM_DIRTY_WORDS; w++)
+        n += __builtin_popcount(e->dirty[w]);
+
+    for (unsigned w = 0; w < VM_DIRTY_WORDS; w++) {
+        // protect steps over the whole mapping; the next one starts on or
+        // after a word boundary unless it's a small page.
+        while (e->dirty[w]) {
+            unsigned i = w * 32 + __builtin_ctz(e->dirty[w]);
+            uint32_t va = i * SM_PAGE_SIZE,
+                     end = next_va(va, protect(e, va));
+            bits_wr(e->dirty, i, PAGE(end - va), 0);
+        }
+    }
+    if (n)
+        dirty_flush(e);
+    return n;
+}
@@ -0,0 +1,47 @@
+#ifndef __DIRTY_H__
+#define __DIRTY_H__
+
+/*
+ * Dirty page tracking
+ * ---
+ * ARMv6 has no dirty bit, so this uses write faults. While an env is tracked,
+ * its writable user pages (ANON, HEAP and STACK regions) are made read-only
+ * with APX, the same encoding COW uses (cow.h). The first write takes a page
+ * permission fault, and vm_dirty_fault marks the page dirty and makes it
+ * writable again, so a page faults at most once between collections. Pages a
+ * COW fault copies and pages demand paging commits are marked dirty as they
+ * are made (data_abort_fast calls vm_dirty_mark).
+ *
+ * Both bitmaps have a bit per 4KB page below ENV_VA_LIMIT; a large page or
+ * section is dirty as a whole. The second one remembers which pages tracking
+ * itself write-protected: APX alone can't tell them from COW or read-only
+ * pages.
+ */
+#include "env.h"
+
+#define VM_DIRTY_WORDS  (ENV_VA_LIMIT / SM_PAGE_SIZE / 32)
+
+// start tracking <e> with an empty dirty set.
+void vm_dirty_track(env_t *e);
+// stop: every page tracking protected is writable again.
+void vm_dirty_untrack(env_t *e);
+
+// copy the dirty set into <out> (VM_DIRTY_WORDS words, bit i = page at
+// i * 4KB; may be 0), empty it and write-protect those pages again. returns
+// the number of dirty 4KB pages.
+unsigned vm_dirty_collect(env_t *e, uint32_t *out);
+
+// a write permission fault at <va>: 1 if it was a page tracking protected
+// (now dirty and writable: retry the access), 0 otherwise.
+int vm_dirty_fault(env_t *e, uint32_t va);
+// mark the mapping covering <va> dirty, if <e> is tracked.
+void vm_dirty_mark(env_t *e, uint32_t va);
+// 1 if tracking has the page at <va> write-protected.
+int vm_dirty_protected(env_t *e, uint32_t va);
+
+// give the pages tracking protected their write access back but keep the
+// dirty set: env_fork does this so COW can share them. writes go through
+// cow_fault, which marks them, from then on.
+void vm_dirty_release(env_t *e);
+
+#endif
@@ -12,81 +12,9 @@
 #include "memmap-constants.h"
 #include "cpsr-util.h"          // CPSR utilities
 #include "cpsr-util-asm.h"
-
-/****************************************************************************************
- * helper code to help set up address space environment.
- */
-#include "bvec.h"
-
-// The environment struct seems to encode the information for an environment.
-typedef struct env {
-    uint32_t pid,
-             domain,
-             asid;
-
-    // the domain register.
-    uint32_t domain_reg;
-    fld_t *pt;
-} env_t;
-
-static bvec_t dom_v, asid_v, env_v;
-static uint32_t pid_cnt;
-
-#define MAX_ENV 8
-static env_t envs[MAX_ENV];
-static env_t *curr_env;
-
-void env_init(void) {
-    dom_v = bvec_mk(1,16);
-    asid_v = bvec_mk(1,64);
-    env_v = bvec_mk(0,MAX_ENV);
-}
-
-env_t *env_alloc(void) {
-    env_t *e = &envs[bvec_alloc(&env_v)];
-
-    e->pt = mmu_pt_alloc(4096);
-    e->pid = ++pid_cnt;
-    e->domain = bvec_alloc(&dom_v);
-    e->asid = bvec_alloc(&asid_v);
-
-    // default: can override.
-    e->domain_reg = 0b01 << e->domain*2; // Determine the register to go to; client (accesses checked)
-    printk("env domain (1-16): %d\nenv domain reg fill: %b", e->domain, e->domain_reg);
-    return e;
-}
-
-void env_free(env_t *e) {
-    unsigned n = e - &envs[0];
-    demand(n < MAX_ENV, freeing unallocated pointer!);
-
-    bvec_free(&dom_v, e->domain);
-    bvec_free(&asid_v, e->asid);
-    bvec_free(&env_v, n);
-
-    // not sure how to free pt.  ugh.
-}
-
-// GF: seems to have appropriate domain switching here...why our domain reg, then ~0UL? accounting for idea that we're not handling domains yet?
-void env_switch_to(env_t *e) {
-    cp15_domain_ctrl_wr(e->domain_reg);
-    // cp15_domain_ctrl_wr(~0UL); // Should trigger a secion domain fault: check writing the reg with mmu on in manual, as well as surfacing correct error code
-
-    cp15_set_procid_ttbr0(e->pid << 8 | e->asid, e->pt); // Ch. B2
-
-    unsigned pid,asid;
-    mmu_get_curpid(&pid, &asid);
-    printk("pid=%d, expect=%d\n", pid, e->pid);
-    printk("asid=%d, expect=%d\n", asid, e->asid);
-
-    assert(pid == e->pid);
-    assert(asid == e->asid);
-    // mmu_asid_print();
-    curr_env = e;
-
-    mmu_enable();
-}
-
+#include "env.h"
+#include "tlb-lock.h"
+#include "fault-stats.h"
 
 /*************************************************************************************
  * your code
@@ -178,18 +106,17 @@ void int_part1(void) {
     mmu_init();
     assert(cpsr_read_c() == SYS_MODE);
 
-    env_t *e = env_alloc();
-
     // map the sections you need. (GF)
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);; // 0x0 is where our code is
-    mmu_map_section(e->pt, SWI_STACK_ADDR, SWI_STACK_ADDR, e->domain, 0);; // SWI_STACK_ADDR is where the SWI stack is
-    mmu_map_section(e->pt, SYS_STACK_ADDR, SYS_STACK_ADDR, e->domain, 0);;
-    mmu_map_section(e->pt, INT_STACK_ADDR, INT_STACK_ADDR, e->domain, 0);;
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);; // 0x0 is where our code is
+    mmu_map_section(kernel_pt, SWI_STACK_ADDR, SWI_STACK_ADDR, KERNEL_DOMAIN, 0);; // SWI_STACK_ADDR is where the SWI stack is
+    mmu_map_section(kernel_pt, SYS_STACK_ADDR, SYS_STACK_ADDR, KERNEL_DOMAIN, 0);;
+    mmu_map_section(kernel_pt, INT_STACK_ADDR, INT_STACK_ADDR, KERNEL_DOMAIN, 0);;
 
     // gpio
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);;
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);;
+    mmu_map_section(kernel_pt, 0x20000000, 0x20000000, KERNEL_DOMAIN, 0);;
+    mmu_map_section(kernel_pt, 0x20200000, 0x20200000, KERNEL_DOMAIN, 0);;
 
+    env_t *e = env_alloc();
     env_switch_to(e);
     assert(cpsr_read_c() == SYS_MODE);
     assert(mmu_is_on());
@@ -224,33 +151,18 @@ void int_part2(void) {
     mmu_init();
     assert(cpsr_read_c() == SYS_MODE);
 
-    env_t *e = env_alloc();
-
-    // map the sections you need. (GF)
-    sec_desc_t *p = (sec_desc_t *)mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
-    p->domain = e->domain;
-    fld_cache_on(p);
-    fld_writeback_on(p);
-    
-    p = (sec_desc_t *)mmu_map_section(e->pt, SWI_STACK_ADDR, SWI_STACK_ADDR, e->domain, 0);
-    p->domain = e->domain;
-    fld_cache_on(p);
-    fld_writeback_on(p);
-
-    p = (sec_desc_t *)mmu_map_section(e->pt, SYS_STACK_ADDR, SYS_STACK_ADDR, e->domain, 0);
-    p->domain = e->domain;
-    fld_cache_on(p);
-    fld_writeback_on(p);
-    
-    p = (sec_desc_t *)mmu_map_section(e->pt, INT_STACK_ADDR, INT_STACK_ADDR, e->domain, 0);
-    p->domain = e->domain;
-    fld_cache_on(p);
-    fld_writeback_on(p);
+    // map the sections you need. (GF) RAM is write-back cacheable by default
+    // (MEM_DEFAULT), which only matters once the caches are on below.
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
+    mmu_map_section(kernel_pt, SWI_STACK_ADDR, SWI_STACK_ADDR, KERNEL_DOMAIN, 0);
+    mmu_map_section(kernel_pt, SYS_STACK_ADDR, SYS_STACK_ADDR, KERNEL_DOMAIN, 0);
+    mmu_map_section(kernel_pt, INT_STACK_ADDR, INT_STACK_ADDR, KERNEL_DOMAIN, 0);
 
     // gpio
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20000000, 0x20000000, KERNEL_DOMAIN, 0);
+    mmu_map_section(kernel_pt, 0x20200000, 0x20200000, KERNEL_DOMAIN, 0);
 
+    env_t *e = env_alloc();
     env_switch_to(e);
     assert(cpsr_read_c() == SYS_MODE);
     assert(mmu_is_on());
@@ -300,7 +212,8 @@ void vm_tests() {
     env_init();
     mmu_init();
     assert(cpsr_read_c() == SYS_MODE);
-    env_t *e = env_alloc();
+    // kernel mappings go in kernel_pt, before the env that links them.
+    env_t *e;
 
 // Define a section to decide which test to run.
 #define VM_PART1 0
@@ -318,13 +231,15 @@ void vm_tests() {
     *((char *)0x400) = 42;
 
     // Just map our section
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
 
+    e = env_alloc();
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
     assert(*((char *)0x400) == 42);
     mmu_disable();
     assert(!mmu_is_on());
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
@@ -338,17 +253,18 @@ void vm_tests() {
     *((char *)(part2_base + 0x400)) = 137;
 
     // Just map our section
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
     // Need to map GPIO for communication
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20000000, 0x20000000, KERNEL_DOMAIN, 0);
+    mmu_map_section(kernel_pt, 0x20200000, 0x20200000, KERNEL_DOMAIN, 0);
     // Need to map interrupt stack to jump to handler code. If you comment out, hangs at the interrupt.
     // The stack grows downwards, so we allocate the section below it.
-    mmu_map_section(e->pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
-        INT_STACK_ADDR - ADDRESSES_PER_MB, e->domain, 0);
+    mmu_map_section(kernel_pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
+        INT_STACK_ADDR - ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
     // kmalloc() allocates the page table here; should also be acessible in VM!
-    mmu_map_section(e->pt, MAX_STACK_ADDR, MAX_STACK_ADDR, e->domain, 0);
+    mmu_map_section(kernel_pt, MAX_STACK_ADDR, MAX_STACK_ADDR, KERNEL_DOMAIN, 0);
 
+    e = env_alloc();
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
     printk("> MMU turned on successfully.\n");
@@ -362,15 +278,17 @@ void vm_tests() {
     PUT32(part2_base + 0x400, 12);
 
     printk("> Mapping a section with VM enabled.\n");
-    fld_t *fld = mmu_map_section(e->pt, part2_base, part2_base, e->domain, 0);
-    fld->domain = e->domain;
-    // fld->AP = 0b00; // Generate section permission fault
+    // env-owned: non-global (tagged with e's ASID) and in e's domain.
+    env_map_section(e, part2_base, part2_base, 0);
+    // env_map_section(e, part2_base, part2_base, F_NO_ACCESS); // Generate section permission fault
+    mmu_sync_map(e->pt, part2_base);
     c = *((char *)part2_base + 0x400);
     printk("Accessing data... <%d>\n", c);
     assert(*((char *)(part2_base + 0x400)) == 137);
     
     mmu_disable();
     assert(!mmu_is_on());
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
@@ -383,18 +301,19 @@ void vm_tests() {
     *((char *)(part3_base + 0x400)) = 125;
 
     // Just map our section
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
     // Need to map GPIO for communication
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20000000, 0x20000000, KERNEL_DOMAIN, 0);
     // mmu_map_section(e->pt, 0x20100000, 0x20100000)->domain = e->domain; // stderr seems to feed through here
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20200000, 0x20200000, KERNEL_DOMAIN, 0);
     // Need to map interrupt stack to jump to handler code. If you comment out, hangs at the interrupt.
     // The stack grows downwards, so we allocate the section below it.
-    mmu_map_section(e->pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
-        INT_STACK_ADDR - ADDRESSES_PER_MB, e->domain, 0);
+    mmu_map_section(kernel_pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
+        INT_STACK_ADDR - ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
     // kmalloc() allocates the page table here; should also be acessible in VM!
-    mmu_map_section(e->pt, MAX_STACK_ADDR, MAX_STACK_ADDR, e->domain, 0);
+    mmu_map_section(kernel_pt, MAX_STACK_ADDR, MAX_STACK_ADDR, KERNEL_DOMAIN, 0);
 
+    e = env_alloc();
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
     printk("> MMU turned on successfully.\n");
@@ -404,7 +323,8 @@ void vm_tests() {
     printk("Accessing data... <%d>\n", c);
 
     printk("> Mapping a small page with VM enabled.\n");
-    mmu_map_sm_page(e->pt, part3_base, part3_base, e->domain, 0);
+    env_map_sm_page(e, part3_base, part3_base, 0);
+    mmu_sync_map(e->pt, part3_base);
 
     c = *((char *)part3_base + 0x400);
     // c = *((char *)part3_base + 0x1000 - 4); // This is right on the boundary of the small page
@@ -414,6 +334,7 @@ void vm_tests() {
     
     mmu_disable();
     assert(!mmu_is_on());
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
@@ -427,20 +348,21 @@ void vm_tests() {
     *((char *)part4_base + 0x10000 - 4) = 137;
 
     // Just map our section
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
     // Need to map GPIO for communication
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20000000, 0x20000000, KERNEL_DOMAIN, 0);
     // mmu_map_section(e->pt, 0x20100000, 0x20100000)->domain = e->domain; // stderr seems to feed through here
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x20200000, 0x20200000, KERNEL_DOMAIN, 0);
     // Need to map interrupt stack to jump to handler code. If you comment out, hangs at the interrupt.
     // The stack grows downwards, so we allocate the section below it.
-    mmu_map_section(e->pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
-        INT_STACK_ADDR - ADDRESSES_PER_MB, e->domain, 0);
+    mmu_map_section(kernel_pt, INT_STACK_ADDR - ADDRESSES_PER_MB, 
+        INT_STACK_ADDR - ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
     // kmalloc() allocates the page table here; should also be acessible in VM!
-    mmu_map_section(e->pt, MAX_STACK_ADDR, MAX_STACK_ADDR, e->domain, 0);
+    mmu_map_section(kernel_pt, MAX_STACK_ADDR, MAX_STACK_ADDR, KERNEL_DOMAIN, 0);
 
+    e = env_alloc();
     printk("> Mapping a large page before turning on VM.\n");
-    mmu_map_lg_page(e->pt, part4_base, part4_base, e->domain, 0);
+    env_map_lg_page(e, part4_base, part4_base, 0);
 
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
@@ -456,7 +378,7 @@ void vm_tests() {
 
     // Does mapping under VM mean that TLB is invalidated?
     // printk("> Mapping a large page with VM enabled.\n");
-    // mmu_map_lg_page(e->pt, part4_base, part4_base, e->domain, 0);
+    // env_map_lg_page(e, part4_base, part4_base, 0);
 
     // cp15_domain_ctrl_wr(~0UL); // Seems okay to write to CP15 while VM is on!
 
@@ -469,6 +391,7 @@ void vm_tests() {
     
     mmu_disable();
     assert(!mmu_is_on());
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
@@ -478,33 +401,28 @@ void vm_tests() {
     printk("\n*** Test 5 ***\n\n");
     printk("> Dereferencing nullptr should yield an error.\n");
 
-    mmu_map_sm_page(e->pt, 0x0, 0x0, e->domain, F_NO_USR_ACCESS); // Map interrupt table with no user access.
-    for (int i = 0; i < 256; i++) { // Map kernel code
-        mmu_map_sm_page(e->pt, KERNEL_BASE + i * ADDRESSES_PER_4KB, 
-            KERNEL_BASE + i * ADDRESSES_PER_4KB, e->domain, 0);
-    }
+    mmu_map_sm_page(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, F_NO_USR_ACCESS); // Map interrupt table with no user access.
+    // Map kernel code (1MB): mostly large pages, small pages at the unaligned ends
+    mmu_map_range(kernel_pt, KERNEL_BASE, KERNEL_BASE, ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
 
     swi_setup_stack(SWI_STACK_ADDR_FINE);
-    mmu_map_lg_page(e->pt, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
-        SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, e->domain, 0);
+    mmu_map_lg_page(kernel_pt, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
+        SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
     
-    mmu_map_lg_page(e->pt, INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
-        INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, e->domain, 0);
+    mmu_map_lg_page(kernel_pt, INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
+        INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
 
     // 1 MB of heap
-    for (int i = 0; i < 16; i++) {
-        mmu_map_lg_page(e->pt, SYS_HEAP_START + i * ADDRESSES_PER_64KB, 
-            SYS_HEAP_START + i * ADDRESSES_PER_64KB, e->domain, 0);
-    }
+    mmu_map_range(kernel_pt, SYS_HEAP_START, SYS_HEAP_START, ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
 
-    mmu_map_section(e->pt, SYS_STACK_ADDR_FINE - ADDRESSES_PER_MB, 
-            SYS_STACK_ADDR_FINE - ADDRESSES_PER_MB, e->domain, 0);
+    mmu_map_section(kernel_pt, SYS_STACK_ADDR_FINE - ADDRESSES_PER_MB, 
+            SYS_STACK_ADDR_FINE - ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
     
-    // Need to map GPIO for communication
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
-    // mmu_map_section(e->pt, 0x20100000, 0x20100000)->domain = e->domain; // stderr seems to feed through here
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    // Need to map GPIO for communication: the whole peripheral window is one
+    // supersection (one TLB entry), which lives in domain 0.
+    mmu_map_range(kernel_pt, PERIPHERAL_BASE, PERIPHERAL_BASE, PERIPHERAL_SIZE, KERNEL_DOMAIN, 0);
 
+    e = env_alloc();
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
     printk("> MMU turned on successfully.\n");
@@ -518,6 +436,7 @@ void vm_tests() {
     
     mmu_disable();
     assert(!mmu_is_on());
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
@@ -530,36 +449,49 @@ void vm_tests() {
     unsigned part6_base = USR_SPACE_START;
     *((char *)(part6_base + 0x400)) = 137;
 
-    mmu_map_section(e->pt, 0x0, 0x0, e->domain, 0);
+    mmu_map_section(kernel_pt, 0x0, 0x0, KERNEL_DOMAIN, 0);
 
     swi_setup_stack(SWI_STACK_ADDR_FINE);
-    mmu_map_lg_page(e->pt, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
-        SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, e->domain, 0);
+    mmu_map_lg_page(kernel_pt, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
+        SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
     
-    mmu_map_lg_page(e->pt, INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
-        INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, e->domain, 0);
+    mmu_map_lg_page(kernel_pt, INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
+        INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
 
     // 1 MB of heap
-    for (int i = 0; i < 16; i++) {
-        mmu_map_lg_page(e->pt, SYS_HEAP_START + i * ADDRESSES_PER_64KB, 
-            SYS_HEAP_START + i * ADDRESSES_PER_64KB, e->domain, 0);
-    }
+    mmu_map_range(kernel_pt, SYS_HEAP_START, SYS_HEAP_START, ADDRESSES_PER_MB, KERNEL_DOMAIN, 0);
 
-    mmu_map_lg_page(e->pt, SYS_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
-            SYS_STACK_ADDR_FINE - ADDRESSES_PER_64KB, e->domain, 0);
+    mmu_map_lg_page(kernel_pt, SYS_STACK_ADDR_FINE - ADDRESSES_PER_64KB, 
+            SYS_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
     
-    // Need to map GPIO for communication
-    mmu_map_section(e->pt, 0x20000000, 0x20000000, e->domain, 0);
-    // mmu_map_section(e->pt, 0x20100000, 0x20100000)->domain = e->domain; // stderr seems to feed through here
-    mmu_map_section(e->pt, 0x20200000, 0x20200000, e->domain, 0);
+    // Need to map GPIO for communication: the whole peripheral window is one
+    // supersection (one TLB entry), which lives in domain 0.
+    mmu_map_range(kernel_pt, PERIPHERAL_BASE, PERIPHERAL_BASE, PERIPHERAL_SIZE, KERNEL_DOMAIN, 0);
+
+    e = env_alloc();
+    // Below the top 64KB, the system stack is demand paged (4KB at a time) down
+    // to the end of the mapped heap.
+    vma_add(e, SYS_HEAP_START + ADDRESSES_PER_MB,
+        SYS_STACK_ADDR_FINE - ADDRESSES_PER_64KB - (SYS_HEAP_START + ADDRESSES_PER_MB), VMA_STACK, 0);
 
     env_switch_to(e); // calls mmu_enable();
     assert(mmu_is_on());
     printk("> MMU turned on successfully.\n");
 
-    // Should fault when uncommented
-    char c = *((char *)part6_base + 0x400);
-    printk("Accessing data... <%d>\n", c);
+    // Keep exception entry and printk off the table walk, whatever user code
+    // does to the rest of the TLB.
+    printk("> Pinned %d kernel translations in the TLB.\n", tlb_lock_kernel(kernel_pt));
+
+    // The hardware walk is the ground truth for the table code.
+    demand(!mmu_xlate_verify(e->pt, 0, ENV_VA_LIMIT)
+        && !mmu_xlate_verify(kernel_pt, PERIPHERAL_BASE, PERIPHERAL_SIZE),
+        software walk disagrees with the hardware);
+    printk("> Software walk matches the hardware.\n");
+
+    // Should fault when uncommented (nothing maps part6_base: the abort
+    // handler reboots, so the cleanup below would never run)
+    // char c = *((char *)part6_base + 0x400);
+    // printk("Accessing data... <%d>\n", c);
 
     // Page miss
     // char c = *((char *)SYS_STACK_ADDR - 0x20000);
@@ -574,32 +506,24 @@ void vm_tests() {
     // printk("Accessing data... <%d>\n", c);
 
     // AP fault
-    // mmu_map_sm_page(e->pt, part6_base, part6_base, e->domain, F_NO_ACCESS);
+    // env_map_sm_page(e, part6_base, part6_base, F_NO_ACCESS);
     // char c = *((char *)part6_base + 0x400);
     // printk("Accessing data... <%d>\n", c);
     
+    tlb_unlock_all();
     mmu_disable();
     assert(!mmu_is_on());
+    fault_stats_dump();
+    env_free(e);
 
     printk("> End of test!\n");
 #endif
-
-    env_free(e);
 }
 
 void syscall_tests() {
     return;
 }
 
-void handle_page_miss(unsigned address) {
-    // Do a one-to-one mapping
-    assert(curr_env);
-    printk("Allocating a new page for the stack...\n");
-    mmu_map_lg_page(curr_env->pt, address - ADDRESSES_PER_4KB, 
-        address - ADDRESSES_PER_4KB, curr_env->domain, 0);
-    printk("All done!\n");
-}
-
 // Main entry point for program
 void notmain() {
     // Initialize UART, enable interrupts
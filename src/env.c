@@ -0,0 +1,272 @@
+/*
+ * File: address space environments
+ * ---
+ * Allocation of pids, domains and ASIDs, and switching between envs. Pulled
+ * out of driver.c so the simulator can run it.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "mmu.h"
+#include "env.h"
+#include "bvec.h"
+#include "cow.h"
+#include "frame.h"
+#include "dirty.h"
+#include "age.h"
+#include "swap.h"
+#include "pt-alloc.h"
+#include "cache.h"
+
+static bvec_t dom_v, asid_v, env_v;
+static uint32_t pid_cnt;
+
+#define MAX_ENV 8
+static env_t envs[MAX_ENV];
+env_t *curr_env;
+fld_t *kernel_pt;
+
+// DACR fields that are the same in every env (named domains and the kernel's),
+// and what they are set to.
+static uint32_t dom_global_mask, dom_global_reg;
+static const char *dom_names[16];
+
+// what the DACR holds while <e> runs.
+static uint32_t env_dacr(env_t *e) {
+    return (e->domain_reg & ~dom_global_mask) | dom_global_reg;
+}
+
+void env_init(void) {
+    dom_v = bvec_mk(1,16);
+    // asid 0 is never handed out: cp15_set_procid_ttbr0 parks on it while
+    // ttbr0 changes (b2-25), so no non-global entry may be tagged with it.
+    asid_v = bvec_mk(1,64);
+    env_v = bvec_mk(0,MAX_ENV);
+    curr_env = 0;
+    // drops the dirty and aging tables too: the heap they came from is new.
+    memset(envs, 0, sizeof envs);
+    dom_global_mask = DOMAIN_FIELD(KERNEL_DOMAIN);
+    dom_global_reg = DOMAIN_CLIENT << KERNEL_DOMAIN*2;
+    memset(dom_names, 0, sizeof dom_names);
+    kernel_pt = mmu_pt_alloc(4096);
+    frame_init(FRAME_START, RAM_SIZE);
+    cow_init(COW_RAM_SIZE);
+    swap_init(0);
+}
+
+// MB i of <e>'s table is still the one env_alloc linked: the kernel's
+// section, or the kernel's coarse table (whatever domain e's entry says).
+static int env_linked(env_t *e, unsigned i) {
+    fld_t *k = &kernel_pt[i], *u = &e->pt[i];
+    if (k->tag == FLD_FAULT_TAG || k->tag != u->tag)
+        return 0;
+    if (k->tag == FLD_COARSE_PT_TAG)
+        return ((coarse_pt_desc_t *)k)->base == ((coarse_pt_desc_t *)u)->base;
+    return !memcmp(k, u, sizeof *k);
+}
+
+// user pages are about to go into [va, va+len): MBs there still linked to one
+// of the kernel's coarse tables get a private copy of it first, or the pages
+// would show up in kernel_pt and every other env. the copy keeps the kernel's
+// (global) entries and the entry's domain.
+static void env_own(env_t *e, uint32_t va, uint32_t len) {
+    unsigned last = (va + len - 1) >> 20, n = 0;
+    for (unsigned i = va >> 20; i <= last; i++) {
+        if (!env_linked(e, i))
+            continue;
+        demand(e->pt[i].tag == FLD_COARSE_PT_TAG, user mapping over a kernel section);
+        uint8_t *t = pt_coarse_alloc();
+        memcpy(t, mmu_pa_to_ptr(((coarse_pt_desc_t *)&kernel_pt[i])->base << 10), PT_COARSE_SIZE);
+        // the same translations, so no TLB entry goes stale: the walk just
+        // has to see the copy.
+        cache_clean_range(t, t + PT_COARSE_SIZE);
+        ((coarse_pt_desc_t *)&e->pt[i])->base = mmu_ptr_to_pa(t) >> 10;
+        cache_clean_range(&e->pt[i], &e->pt[i + 1]);
+        n++;
+    }
+    if (n)
+        mmu_xlate_inval();
+}
+
+env_t *env_alloc(void) {
+    env_t *e = &envs[bvec_alloc(&env_v)];
+
+    // user space only; the kernel's low entries are shared, not re-mapped.
+    e->pt = mmu_pt_alloc(ENV_PT_ENTRIES);
+    memcpy(e->pt, kernel_pt, ENV_PT_ENTRIES * sizeof *e->pt);
+    e->pid = ++pid_cnt;
+    e->domain = bvec_alloc(&dom_v);
+    e->asid = bvec_alloc(&asid_v);
+    e->n_vma = 0;
+    e->dirty_on = 0;
+    e->age_on = 0;
+    e->n_swapped = 0;
+
+    // default: can override.
+    e->domain_reg = DOMAIN_CLIENT << e->domain*2; // client (accesses checked)
+    e->domain_reg |= DOMAIN_CLIENT << KERNEL_DOMAIN*2; // Shared kernel domain
+    return e;
+}
+
+void env_free(env_t *e) {
+    unsigned n = e - &envs[0];
+    demand(n < MAX_ENV, freeing unallocated pointer!);
+    demand(e->pt, env already freed);
+    demand(e != curr_env || !cp15_ctrl_reg1_rd().MMU_enabled, freeing running env);
+
+    // drop its non-global TLB entries before the asid is reused.
+    cp15_tlb_inv_asid(e->asid);
+
+    // pages hidden by aging have the wrong AP for cow_release_pt; swapped
+    // out ones only hold pool space.
+    vm_age_stop(e);
+    vm_swap_drop(e);
+
+    // unlink the kernel's entries (its coarse tables are not ours to free),
+    // then frames nobody else maps and the page tables go back to the pools.
+    for(unsigned i = 0; i < ENV_PT_ENTRIES; i++)
+        if(env_linked(e, i))
+            memset(&e->pt[i], 0, sizeof e->pt[i]);
+    cow_release_pt(e->pt, ENV_PT_ENTRIES);
+    mmu_pt_free(e->pt, ENV_PT_ENTRIES);
+    e->pt = 0;
+
+    bvec_free(&dom_v, e->domain);
+    bvec_free(&asid_v, e->asid);
+    bvec_free(&env_v, n);
+    if(e == curr_env)
+        curr_env = 0;
+}
+
+// Child gets a copy of the parent's page tables, not its memory: user pages
+// are shared copy-on-write (cow.c); env_alloc already linked the kernel.
+env_t *env_fork(env_t *parent) {
+    env_t *e = env_alloc();
+    e->domain_reg = parent->domain_reg & ~(0b11 << parent->domain*2);
+    e->domain_reg |= ((parent->domain_reg >> parent->domain*2) & 0b11) << e->domain*2;
+
+    // pages dirty tracking write-protected aren't COW pages (cow_share would
+    // skip them): make them writable first, COW faults mark them from here on.
+    // pages hidden by aging need their AP back for the same reason, and
+    // swapped out ones have to be there to be shared at all.
+    vm_swap_release(parent);
+    vm_dirty_release(parent);
+    vm_age_release(parent);
+    // where the parent has its own copy of a kernel coarse table, so does the
+    // child: unlink the kernel's so cow_clone_pt copies the parent's.
+    for (unsigned i = 0; i < ENV_PT_ENTRIES; i++)
+        if (env_linked(e, i) && !env_linked(parent, i))
+            memset(&e->pt[i], 0, sizeof e->pt[i]);
+    cow_clone_pt(e->pt, parent->pt, ENV_PT_ENTRIES, parent->domain, e->domain);
+    memcpy(e->vma, parent->vma, sizeof e->vma);
+    e->n_vma = parent->n_vma;
+
+    // the parent's writable pages just went read-only: push both tables'
+    // descriptors out and drop its (asid-tagged) TLB entries for them.
+    mmu_pt_clean(e->pt, ENV_PT_ENTRIES);
+    mmu_pt_clean(parent->pt, ENV_PT_ENTRIES);
+    cp15_tlb_inv_asid(parent->asid);
+    return e;
+}
+
+// Context switch. User entries are tagged with the asid and kernel entries are
+// global, so nothing in the TLB has to go; the caches are physically tagged.
+// cp15_set_procid_ttbr0 flushes the BTB, which is indexed by VA. TTBR1 and
+// TTBCR never change once the MMU is on: every env shares kernel_pt.
+void env_switch_to(env_t *e) {
+    int mmu_on = cp15_ctrl_reg1_rd().MMU_enabled;
+    if(!mmu_on) {
+        cp15_ttbr_ctrl_wr(ENV_TTBCR_N);
+        cp15_ttbr1_wr((cp15_tlb_reg_t){ .base = mmu_ptr_to_pa(kernel_pt) });
+    }
+    cp15_domain_ctrl_wr(env_dacr(e));
+    cp15_set_procid_ttbr0(e->pid << 8 | e->asid, e->pt); // Ch. B2
+    curr_env = e;
+
+    if(!mmu_on)
+        mmu_enable();
+}
+
+/* user mappings: non-global, in the env's domain */
+
+fld_t *env_map_section(env_t *e, uint32_t va, uint32_t pa, int flags) {
+    demand(va < ENV_VA_LIMIT, va is in the kernel half);
+    env_own(e, va, SECTION_SIZE);
+    return mmu_map_section(e->pt, va, pa, e->domain, flags | F_NOT_GLOBAL);
+}
+sld_t *env_map_lg_page(env_t *e, uint32_t va, uint32_t pa, int flags) {
+    demand(va < ENV_VA_LIMIT, va is in the kernel half);
+    env_own(e, va, LG_PAGE_SIZE);
+    return mmu_map_lg_page(e->pt, va, pa, e->domain, flags | F_NOT_GLOBAL);
+}
+sld_t *env_map_sm_page(env_t *e, uint32_t va, uint32_t pa, int flags) {
+    demand(va < ENV_VA_LIMIT, va is in the kernel half);
+    env_own(e, va, SM_PAGE_SIZE);
+    return mmu_map_sm_page(e->pt, va, pa, e->domain, flags | F_NOT_GLOBAL);
+}
+unsigned env_map_range(env_t *e, uint32_t va, uint32_t pa, uint32_t len, int flags) {
+    demand(va + len > va && va + len <= ENV_VA_LIMIT, range runs into the kernel half);
+    env_own(e, va, len);
+    return mmu_map_range(e->pt, va, pa, len, e->domain, flags | F_NOT_GLOBAL);
+}
+
+unsigned env_promote(env_t *e) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < e->n_vma; i++)
+        // a MB by MB: one still linked to the kernel's table has no user pages,
+        // and promoting would rewrite (or free) the kernel's.
+        for (uint32_t va = e->vma[i].start; va < e->vma[i].end; ) {
+            uint32_t next = (va & ~(SECTION_SIZE - 1)) + SECTION_SIZE;
+            if (!next || next > e->vma[i].end)
+                next = e->vma[i].end;
+            if (!env_linked(e, va >> 20))
+                n += mmu_promote(e->pt, va, next - va);
+            va = next;
+        }
+    return n;
+}
+
+/* named domains */
+
+unsigned env_domain_alloc(const char *name) {
+    demand(name && !env_domain_lookup(name), domain name taken);
+    unsigned d = bvec_alloc(&dom_v);
+    dom_names[d] = name;
+    dom_global_mask |= DOMAIN_FIELD(d);
+    env_domains_set(DOMAIN_FIELD(d), DOMAIN_CLIENT << d*2);
+    return d;
+}
+
+unsigned env_domain_lookup(const char *name) {
+    for(unsigned d = 1; d < 16; d++)
+        if(dom_names[d] && !strcmp(dom_names[d], name))
+            return d;
+    return 0;
+}
+
+void env_domain_free(unsigned d) {
+    demand(d < 16 && dom_names[d], not a named domain);
+    env_domains_set(DOMAIN_FIELD(d), DOMAIN_NO_ACCESS);
+    dom_global_mask &= ~DOMAIN_FIELD(d);
+    dom_names[d] = 0;
+    bvec_free(&dom_v, d);
+}
+
+unsigned env_domain_assign(fld_t *pt, uint32_t va, uint32_t len, unsigned d) {
+    demand(d < 16 && dom_names[d], not a named domain);
+    return mmu_set_domain(pt, va, len, d);
+}
+
+uint32_t env_domains_set(uint32_t mask, uint32_t fields) {
+    demand(!(mask & ~dom_global_mask), not a named domain or the kernel domain);
+    uint32_t old = dom_global_reg & mask;
+    dom_global_reg = (dom_global_reg & ~mask) | (fields & mask);
+    // B4-10: takes effect without touching the TLB, which doesn't hold access.
+    if(curr_env)
+        cp15_domain_ctrl_wr(env_dacr(curr_env));
+    return old;
+}
+
+unsigned env_domain_set(unsigned d, unsigned access) {
+    demand(d < 16 && access != DOMAIN_RESERVED && access <= DOMAIN_MANAGER, bad domain access);
+    return env_domains_set(DOMAIN_FIELD(d), access << d*2) >> d*2;
+}
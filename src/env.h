@@ -0,0 +1,131 @@
+#ifndef __ENV_H__
+#define __ENV_H__
+
+/*
+ * Address space environments
+ * ---
+ * Each env owns a first-level table, a domain (1-15) and an ASID (1-63). User
+ * mappings made through env_map_* are non-global (nG=1, pg. B4-25): their TLB
+ * entries are tagged with the env's ASID, so switching envs is just a write of
+ * the DACR, TTBR0 and context ID with no TLB or cache maintenance. The
+ * arm1176 caches are physically tagged, so they survive the switch too.
+ *
+ * Kernel mappings (code, stacks, heap, peripherals) go through mmu_map_* on
+ * the one kernel_pt, in KERNEL_DOMAIN, and stay global. A global mapping must
+ * be identical in every env that has it: its TLB entry matches under any
+ * ASID. It also has to be reachable under every env's DACR, since the switch
+ * code runs from it while the registers change one at a time.
+ *
+ * The address space is split with TTBCR.N (pg. B4-41): an env's table sits in
+ * TTBR0 and only covers [0, ENV_VA_LIMIT), so it is 2KB instead of 16KB, and
+ * kernel_pt sits in TTBR1 for everything above (the peripherals). The kernel
+ * image, stacks and heap are identity mapped low, inside TTBR0's range:
+ * env_alloc links them in by copying kernel_pt's first ENV_PT_ENTRIES
+ * entries, which point at the kernel's own sections and coarse tables. So
+ * make the kernel's low mappings before any env_alloc; pages added later to a
+ * linked coarse table show up everywhere, new first-level entries don't.
+ *
+ * User pages never go into a linked table: the first env_map_* into a MB
+ * covered by one of the kernel's coarse tables gives the env a private copy
+ * of it (the kernel's entries included, the domain unchanged), and from then
+ * on kernel pages added to that MB don't show up in the env. User mappings
+ * over a kernel section are refused.
+ */
+#include "mmu.h"
+#include "vma.h"
+
+// shared by all envs (client in every domain_reg); supersections live here too.
+#define KERNEL_DOMAIN 0
+
+// TTBR0 translates [0, ENV_VA_LIMIT) through the env's table, TTBR1 the rest
+// through kernel_pt. N = 3 puts the boundary at the peripheral window.
+#define ENV_TTBCR_N     3
+#define ENV_VA_LIMIT    (1u << (32 - ENV_TTBCR_N))
+#define ENV_PT_ENTRIES  (4096 >> ENV_TTBCR_N)
+
+// the kernel's mappings (full 4096 entries), made by env_init.
+extern fld_t *kernel_pt;
+
+typedef struct env {
+    uint32_t pid,
+             domain,
+             asid;
+
+    // the domain register.
+    uint32_t domain_reg;
+    fld_t *pt;
+
+    // user regions, sorted by address (vma.c).
+    vma_t vma[ENV_MAX_VMA];
+    unsigned n_vma;
+
+    // dirty tracking (dirty.c): on/off and its bitmaps, kept with the slot.
+    unsigned dirty_on;
+    uint32_t *dirty;
+
+    // page aging (age.c): on/off, last working set estimate and the ages,
+    // also kept with the slot.
+    unsigned age_on;
+    uint32_t wss;
+    struct vm_age *age;
+
+    // mappings swapped out (swap.c).
+    unsigned n_swapped;
+} env_t;
+
+// env running on the cpu (0 before the first env_switch_to).
+extern env_t *curr_env;
+
+void env_init(void);
+env_t *env_alloc(void);
+void env_free(env_t *e);
+
+// new env sharing <parent>'s memory copy-on-write (see cow.h).
+env_t *env_fork(env_t *parent);
+
+// first call sets TTBCR/TTBR1 and enables the MMU; after that just DACR +
+// TTBR0 + ASID.
+void env_switch_to(env_t *e);
+
+// mmu_map_* in <e>'s domain, with F_NOT_GLOBAL added to <flags>. va must be
+// below ENV_VA_LIMIT.
+fld_t *env_map_section(env_t *e, uint32_t va, uint32_t pa, int flags);
+sld_t *env_map_lg_page(env_t *e, uint32_t va, uint32_t pa, int flags);
+sld_t *env_map_sm_page(env_t *e, uint32_t va, uint32_t pa, int flags);
+unsigned env_map_range(env_t *e, uint32_t va, uint32_t pa, uint32_t len, int flags);
+
+/*
+ * Named domains (pg. B4-10): a set of 1MB regions, in any tables, whose access
+ * is switched all at once by its DACR field instead of by rewriting every
+ * descriptor's AP bits and flushing the TLB: revoke or grant it, or make it
+ * manager so accesses skip the AP checks. A named domain's setting holds in
+ * every env. Domains come out of the same 15 as env domains.
+ *
+ * A region's domain is in its first-level descriptor, so regions are whole
+ * MBs and supersections can't be moved out of domain 0. Like kernel mappings,
+ * kernel_pt regions moved before an env_alloc are moved in that env too.
+ */
+#define DOMAIN_FIELD(d) (0b11u << (d) * 2)
+
+// a new domain called <name> (kept, not copied), client to start with.
+unsigned env_domain_alloc(const char *name);
+// 0 if there is no domain called <name>.
+unsigned env_domain_lookup(const char *name);
+// its regions should be moved out first: they become no access.
+void env_domain_free(unsigned d);
+
+// move [va, va+len) of <pt> (1MB aligned) into named domain <d>.
+unsigned env_domain_assign(fld_t *pt, uint32_t va, uint32_t len, unsigned d);
+
+// the DACR fields under <mask>, of named domains and KERNEL_DOMAIN only,
+// become <fields>: one DACR write, no TLB maintenance. returns the old
+// fields, so env_domains_set(mask, old) undoes it.
+uint32_t env_domains_set(uint32_t mask, uint32_t fields);
+// a single domain: DOMAIN_NO_ACCESS, _CLIENT or _MANAGER; returns the old one.
+unsigned env_domain_set(unsigned d, unsigned access);
+
+// mmu_promote over each of <e>'s regions: bigger pages where demand paging
+// has filled them in. <e> must not be running user code meanwhile.
+unsigned env_promote(env_t *e);
+
+#endif
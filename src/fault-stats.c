@@ -0,0 +1,121 @@
+/*
+ * File: data abort statistics
+ * ---
+ * Counters for fault-stats.h. Per-env counts are kept by ASID, which an env
+ * holds for as long as it lives, and tagged with the pid so a slot restarts
+ * when its ASID goes to a new env. Cycle totals are printed in units of 1024
+ * cycles to keep 64-bit division out of the kernel.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "env.h"
+#include "fault-stats.h"
+
+#define FAULT_N_ASID 64
+
+static fault_stats_t stats;
+static struct {
+    uint32_t pid;
+    unsigned n_faults;
+    uint64_t cycles;
+} by_asid[FAULT_N_ASID];
+
+// the statuses the fast path sees in normal operation (pg. B4-20).
+static const char *status_name[FAULT_N_STATUS] = {
+    [0b00001] = "alignment",
+    [0b00101] = "section xlate",
+    [0b00111] = "page xlate",
+    [0b01001] = "section domain",
+    [0b01011] = "page domain",
+    [0b01101] = "section perm",
+    [0b01111] = "page perm",
+};
+
+void fault_stats_init(void) {
+    memset(&stats, 0, sizeof stats);
+    memset(by_asid, 0, sizeof by_asid);
+    cp15_pmnc_wr((cp15_pmnc_rd() & ~PMNC_CYCLE_DIV64) | PMNC_ENABLE | PMNC_CYCLE_RESET);
+}
+
+static unsigned hist_bucket(uint32_t cycles) {
+    uint32_t b = cycles >> FAULT_HIST_SHIFT;
+    if (!b)
+        return 0;
+    unsigned i = 32 - __builtin_clz(b);
+    return i < FAULT_HIST_BUCKETS ? i : FAULT_HIST_BUCKETS - 1;
+}
+
+void fault_stats_record(env_t *e, unsigned status, unsigned domain, int fixed,
+                        uint32_t cycles) {
+    status %= FAULT_N_STATUS;
+    if (domain > FAULT_NO_DOMAIN)
+        domain = FAULT_NO_DOMAIN;
+
+    stats.n_faults++;
+    stats.n_fixed += fixed != 0;
+    stats.cycles += cycles;
+    stats.n_status[status]++;
+    stats.status_cycles[status] += cycles;
+    stats.n_domain[domain]++;
+    stats.hist[hist_bucket(cycles)]++;
+
+    if (!e)
+        return;
+    unsigned a = e->asid % FAULT_N_ASID;
+    if (by_asid[a].pid != e->pid) {
+        by_asid[a].pid = e->pid;
+        by_asid[a].n_faults = 0;
+        by_asid[a].cycles = 0;
+    }
+    by_asid[a].n_faults++;
+    by_asid[a].cycles += cycles;
+}
+
+unsigned fault_stats_env(env_t *e, uint64_t *cycles) {
+    unsigned a = e->asid % FAULT_N_ASID;
+    if (by_asid[a].pid != e->pid)
+        return *cycles = 0;
+    *cycles = by_asid[a].cycles;
+    return by_asid[a].n_faults;
+}
+
+fault_stats_t fault_stats(void) {
+    return stats;
+}
+
+void fault_stats_dump(void) {
+    printk("faults: %d (%d fixed), %d Kcycles\n",
+        stats.n_faults, stats.n_fixed, (unsigned)(stats.cycles >> 10));
+
+    for (unsigned i = 0; i < FAULT_N_STATUS; i++)
+        if (stats.n_status[i])
+            printk("  status 0x%x %s: %d, %d Kcycles\n", i,
+                status_name[i] ? status_name[i] : "other",
+                stats.n_status[i], (unsigned)(stats.status_cycles[i] >> 10));
+
+    printk("  by domain:");
+    for (unsigned i = 0; i < FAULT_NO_DOMAIN; i++)
+        if (stats.n_domain[i])
+            printk(" %d:%d", i, stats.n_domain[i]);
+    if (stats.n_domain[FAULT_NO_DOMAIN])
+        printk(" none:%d", stats.n_domain[FAULT_NO_DOMAIN]);
+    printk("\n");
+
+    printk("  by env:");
+    for (unsigned i = 0; i < FAULT_N_ASID; i++)
+        if (by_asid[i].n_faults)
+            printk(" pid %d:%d/%dK", by_asid[i].pid, by_asid[i].n_faults,
+                (unsigned)(by_asid[i].cycles >> 10));
+    printk("\n");
+
+    // "<2^k:n" per non-empty bucket: n handlers took under 2^k cycles.
+    printk("  cycles:");
+    for (unsigned i = 0; i < FAULT_HIST_BUCKETS; i++)
+        if (stats.hist[i]) {
+            if (i == FAULT_HIST_BUCKETS - 1)
+                printk(" >=2^%d:%d", i - 1 + FAULT_HIST_SHIFT, stats.hist[i]);
+            else
+                printk(" <2^%d:%d", i + FAULT_HIST_SHIFT, stats.hist[i]);
+        }
+    printk("\n");
+}
@@ -0,0 +1,50 @@
+#ifndef __FAULT_STATS_H__
+#define __FAULT_STATS_H__
+
+/*
+ * Data abort statistics
+ * ---
+ * Always on: data_abort_fast records every data abort it takes, fixed or not,
+ * by fault status (WFAULT_STATUS, pg. B4-20), domain and env, with the cycles
+ * the handler spent on it (the cycle counter, c15). The point is to see how
+ * much time goes to demand paging and permission (COW) faults before tuning
+ * page sizes or prefaulting.
+ *
+ * Handler latency goes into a log2 histogram: bucket 0 is under
+ * 1 << FAULT_HIST_SHIFT cycles, bucket i covers [1 << (i-1+SHIFT), 1 << (i+SHIFT)),
+ * and the last one everything above.
+ */
+#include <stdint.h>
+#include "env.h"
+
+#define FAULT_N_STATUS      32  // 5-bit status
+#define FAULT_NO_DOMAIN     16  // the status leaves the domain field invalid
+#define FAULT_HIST_BUCKETS  16
+#define FAULT_HIST_SHIFT    6
+
+typedef struct {
+    unsigned n_faults,
+             n_fixed;           // resolved by data_abort_fast
+    uint64_t cycles;
+
+    unsigned n_status[FAULT_N_STATUS];
+    uint64_t status_cycles[FAULT_N_STATUS];
+    unsigned n_domain[FAULT_NO_DOMAIN + 1];
+    unsigned hist[FAULT_HIST_BUCKETS];
+} fault_stats_t;
+
+// zero the counters and start the cycle counter.
+void fault_stats_init(void);
+
+// one abort taken while <e> ran (0 if none): <status> as WFAULT_STATUS,
+// <domain> 0-15 or FAULT_NO_DOMAIN, <fixed> if the handler resolved it.
+void fault_stats_record(env_t *e, unsigned status, unsigned domain, int fixed,
+                        uint32_t cycles);
+
+// faults and handler cycles of the env with <e>'s pid; 0 if none recorded.
+unsigned fault_stats_env(env_t *e, uint64_t *cycles);
+
+fault_stats_t fault_stats(void);
+void fault_stats_dump(void);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * File: physical frame allocator
+ * ---
+ * Block i of order k covers [base + i * (4KB << k), +4KB << k), with base
+ * 1MB-aligned so that every block is aligned to its size and its buddy is
+ * block i ^ 1. A set bit in free_bits[k] means the block is free and whole;
+ * head[] remembers the order of each allocated block by its first frame, so
+ * frees can be checked.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "mmu.h"
+#include "env.h"
+#include "helper-macros.h"
+#include "memmap-constants.h"
+#include "frame.h"
+
+#define ORDERS 9    // 4KB << 0 .. 4KB << 8 = 1MB
+
+static uint32_t base;
+static unsigned n_frames;
+static uint32_t *free_bits[ORDERS];
+static unsigned n_free_blocks[ORDERS],
+                hint[ORDERS];   // no free block below this word
+static uint8_t *head;           // order + 1 of the allocated block starting here
+static unsigned kmapped;        // size mapped at FRAME_WINDOW, 0 if none
+static frame_stats_t stats;
+
+static unsigned order_of(unsigned size) {
+    demand(size >= FRAME_MIN_SIZE && size <= FRAME_MAX_SIZE && !(size & (size - 1)),
+        not a frame size);
+    return __builtin_ctz(size / FRAME_MIN_SIZE);
+}
+
+static inline int is_free(unsigned k, unsigned i) {
+    return free_bits[k][i / 32] >> (i % 32) & 1;
+}
+static inline void set_free(unsigned k, unsigned i) {
+    free_bits[k][i / 32] |= 1u << (i % 32);
+    n_free_blocks[k]++;
+    if (i / 32 < hint[k])
+        hint[k] = i / 32;
+}
+static inline void clr_free(unsigned k, unsigned i) {
+    free_bits[k][i / 32] &= ~(1u << (i % 32));
+    n_free_blocks[k]--;
+}
+
+void frame_init(uint32_t start, uint32_t end) {
+    start = (start + FRAME_MIN_SIZE - 1) & ~(FRAME_MIN_SIZE - 1);
+    end &= ~(FRAME_MIN_SIZE - 1);
+    demand(start < end, empty frame range);
+
+    // a whole number of 1MB blocks, so every buddy is inside the bitmaps.
+    base = start & ~(FRAME_MAX_SIZE - 1);
+    n_frames = ((end - base + FRAME_MAX_SIZE - 1) & ~(FRAME_MAX_SIZE - 1)) / FRAME_MIN_SIZE;
+    for (unsigned k = 0; k < ORDERS; k++) {
+        unsigned n_words = ((n_frames >> k) + 31) / 32;
+        free_bits[k] = kmalloc(n_words * sizeof free_bits[k][0]);
+        n_free_blocks[k] = 0;
+        hint[k] = n_words;
+    }
+    head = kmalloc(n_frames);
+    kmapped = 0;
+    memset(&stats, 0, sizeof stats);
+
+    // carve the range into the biggest aligned blocks that fit.
+    for (uint32_t pa = start; pa < end; ) {
+        unsigned k = ORDERS - 1;
+        while (!is_aligned(pa, FRAME_MIN_SIZE << k) || end - pa < (FRAME_MIN_SIZE << k))
+            k--;
+        set_free(k, (pa - base) / (FRAME_MIN_SIZE << k));
+        pa += FRAME_MIN_SIZE << k;
+    }
+    stats.n_bytes = stats.n_free = end - start;
+}
+
+uint32_t frame_alloc(unsigned size) {
+    unsigned o = order_of(size), k = o;
+    while (k < ORDERS && !n_free_blocks[k])
+        k++;
+    if (k == ORDERS)
+        return 0;
+
+    // lowest free block of the smallest order that has one.
+    unsigned w = hint[k];
+    while (!free_bits[k][w])
+        w++;
+    hint[k] = w;
+    unsigned i = w * 32 + __builtin_ctz(free_bits[k][w]);
+    clr_free(k, i);
+
+    // split down to size: keep the low half, free the high one.
+    for (; k > o; k--) {
+        i *= 2;
+        set_free(k - 1, i + 1);
+        stats.n_splits++;
+    }
+
+    uint32_t pa = base + i * size;
+    head[(pa - base) / FRAME_MIN_SIZE] = o + 1;
+    stats.n_free -= size;
+    stats.n_allocs++;
+    return pa;
+}
+
+void frame_free(uint32_t pa, unsigned size) {
+    unsigned o = order_of(size), f = (pa - base) / FRAME_MIN_SIZE;
+    demand(pa >= base && f < n_frames && head[f] == o + 1, not an allocated frame of this size);
+    head[f] = 0;
+
+    // merge with the buddy for as long as it is free too.
+    unsigned i = f >> o, k = o;
+    for (; k < ORDERS - 1 && is_free(k, i ^ 1); k++, i >>= 1) {
+        clr_free(k, i ^ 1);
+        stats.n_merges++;
+    }
+    set_free(k, i);
+    stats.n_free += size;
+    stats.n_frees++;
+}
+
+uint32_t frame_release(uint32_t pa, uint32_t size) {
+    uint32_t n = 0;
+    for (uint32_t off = 0; off < size; ) {
+        uint32_t f = (pa + off - base) / FRAME_MIN_SIZE;
+        if (pa + off < base || f >= n_frames)
+            break;
+        uint32_t sz = FRAME_MIN_SIZE;
+        if (head[f] && (sz = FRAME_MIN_SIZE << (head[f] - 1)) <= size - off) {
+            frame_free(pa + off, sz);
+            n += sz;
+        }
+        off += sz;
+    }
+    return n;
+}
+
+void *frame_kmap(uint32_t pa, unsigned size) {
+    if (!cp15_ctrl_reg1_rd().MMU_enabled)
+        return mmu_pa_to_ptr(pa);
+    demand(!kmapped, the frame window is in use);
+
+    switch (size) {
+    case SECTION_SIZE:
+        mmu_map_section(kernel_pt, FRAME_WINDOW, pa, KERNEL_DOMAIN, F_NO_USR_ACCESS);
+        break;
+    case LG_PAGE_SIZE:
+        mmu_map_lg_page(kernel_pt, FRAME_WINDOW, pa, KERNEL_DOMAIN, F_NO_USR_ACCESS);
+        break;
+    default:
+        demand(size == SM_PAGE_SIZE, not a frame size);
+        mmu_map_sm_page(kernel_pt, FRAME_WINDOW, pa, KERNEL_DOMAIN, F_NO_USR_ACCESS);
+        break;
+    }
+    mmu_sync_map(kernel_pt, FRAME_WINDOW);
+    kmapped = size;
+    return mmu_va_to_ptr(FRAME_WINDOW, pa);
+}
+
+void frame_kunmap(void) {
+    // nothing mapped if the MMU was off.
+    if (kmapped)
+        mmu_unmap(kernel_pt, FRAME_WINDOW);
+    kmapped = 0;
+}
+
+frame_stats_t frame_stats(void) {
+    stats.n_free_max = n_free_blocks[ORDERS - 1];
+    return stats;
+}
+
+void frame_stats_print(const char *msg) {
+    frame_stats_t s = frame_stats();
+    printk("%s: %d of %d KB free (%d free 1MB blocks), %d allocs, %d frees\n",
+        msg, s.n_free / 1024, s.n_bytes / 1024, s.n_free_max, s.n_allocs, s.n_frees);
+}
@@ -0,0 +1,53 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+/*
+ * Physical frame allocator
+ * ---
+ * Hands out naturally aligned 4KB, 64KB and 1MB frames of RAM, one per page
+ * size (pg. B4-31), from [FRAME_START, RAM_SIZE) (memmap-constants.h). It is a
+ * buddy allocator: a free bitmap per size, 4KB << 0 through 4KB << 8, where
+ * a block is split in halves to satisfy a smaller request and merged with its
+ * free buddy (the other half of its parent) when it comes back. Nothing is
+ * stored in the frames themselves, which the kernel usually has no mapping
+ * of; frame_kmap gives it one.
+ *
+ * Frames are not zeroed.
+ */
+#include <stdint.h>
+#include "mmu.h"
+
+#define FRAME_MIN_SIZE  SM_PAGE_SIZE
+#define FRAME_MAX_SIZE  SECTION_SIZE
+
+// manage [start, end): both are rounded in to 4KB.
+void frame_init(uint32_t start, uint32_t end);
+
+// a <size> frame aligned to <size> (4KB, 64KB or 1MB), or 0 if none is left.
+uint32_t frame_alloc(unsigned size);
+// give back a frame from frame_alloc(size).
+void frame_free(uint32_t pa, unsigned size);
+
+// free every frame allocated inside [pa, pa+size); returns the bytes freed.
+// for mappings that may be backed by several frames (mmu_promote) or none.
+uint32_t frame_release(uint32_t pa, uint32_t size);
+
+// kernel pointer to the <size> frame at <pa>: mapped at FRAME_WINDOW in
+// kernel_pt while the MMU is on, so one frame at a time.
+void *frame_kmap(uint32_t pa, unsigned size);
+void frame_kunmap(void);
+
+typedef struct {
+    uint32_t n_bytes,   // managed
+             n_free;    // bytes free
+    unsigned n_allocs,
+             n_frees,
+             n_splits,
+             n_merges,
+             n_free_max; // free 1MB blocks
+} frame_stats_t;
+
+frame_stats_t frame_stats(void);
+void frame_stats_print(const char *msg);
+
+#endif
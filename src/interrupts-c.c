@@ -7,6 +7,14 @@
 #include "interrupts-asm.h"
 #include "mmu.h"
 #include "memmap-constants.h"
+#include "env.h"
+#include "cow.h"
+#include "vma.h"
+#include "cp15-arm.h"
+#include "fault-stats.h"
+#include "dirty.h"
+#include "age.h"
+#include "swap.h"
 
 #define DEBUG_HANDLE_DATA_ABORTS 1
 #define DEBUG_PRINT_DATA_ABORTS 1
@@ -38,6 +46,57 @@ void prefetch_abort_vector(unsigned pc) {
 	UNHANDLED("prefetch abort", pc);
 }
 
+// Resolve faults that are part of normal operation; 1 if fixed.
+//  - translation faults on pages swapped out: swap them in (swap.c)
+//  - translation faults in one of the env's regions: demand paging (vma.c)
+//  - writes to pages shared by env_fork: copy-on-write (cow.c)
+//  - first writes to pages dirty tracking protected (dirty.c)
+//  - user accesses to pages page aging hid (age.c)
+// pages the first two make writable are dirty too.
+static int data_abort_fix(unsigned faultval, unsigned address) {
+    // above ENV_VA_LIMIT is kernel_pt's (TTBR1): never the env's to fix.
+    if (!curr_env || address >= ENV_VA_LIMIT)
+        return 0;
+
+    switch (WFAULT_STATUS(faultval)) {
+    case 0b00101: // Section translation
+    case 0b00111: // Page translation
+        if (vm_swap_fault(curr_env, address))
+            return 1;
+        if (!vma_fault(curr_env, address))
+            return 0;
+        vm_dirty_mark(curr_env, address);
+        return 1;
+    case 0b01101: // Section permission fault
+    case 0b01111: // Page permission fault
+        if (vm_age_fault(curr_env, address))
+            return 1;
+        if (!WIF_WRITE(faultval))
+            return 0;
+        if (cow_fault(curr_env->pt, address)) {
+            vm_dirty_mark(curr_env, address);
+            return 1;
+        }
+        return vm_dirty_fault(curr_env, address);
+    }
+    return 0;
+}
+
+// Fast path, called straight from data_abort_asm with the fault status and
+// address registers: returns 1 if the fault was fixed, so the aborted
+// instruction is retried. Nothing here prints; every abort is counted and
+// timed (fault-stats.h).
+int data_abort_fast(unsigned faultval, unsigned address) {
+    uint32_t start = cp15_cycle_cnt_rd();
+    int fixed = data_abort_fix(faultval, address);
+    fault_stats_record(curr_env, WFAULT_STATUS(faultval),
+        fault_status_has_valid_domain(faultval) ? WFAULT_DOMAIN(faultval) : FAULT_NO_DOMAIN,
+        fixed, cp15_cycle_cnt_rd() - start);
+    return fixed;
+}
+
+// Slow path: data_abort_fast could not fix the fault. pc is the aborted
+// instruction, which data_abort_asm skips on return.
 void data_abort_vector(unsigned pc) {
     // cpsr_print_mode(cpsr_read()); // Will be in abort mode
 #if DEBUG_PRINT_DATA_ABORTS == 1
@@ -52,17 +111,8 @@ void data_abort_vector(unsigned pc) {
             printk("Illegal access of 0x0. Aborting...");
             clean_reboot();
         }
-
-        if (address < SYS_STACK_ADDR_FINE && address > (unsigned)kmalloc_heap_end()) {
-            // Within system stack bounds and above heap, initiate a page miss
-            // Could make more fine grained
-            handle_page_miss(address);
-        } else if (address < (unsigned)kmalloc_heap_start() || address > (unsigned)kmalloc_heap_end()) {
-            printk("Outside of heap <range 0x%x to 0x%x>, fatal error. Quitting...\n", 
-                (unsigned)kmalloc_heap_start(), 
-                (unsigned)kmalloc_heap_end());
-            clean_reboot(); // TODO: fail gracefully?
-        }
+        printk("No region of the current env covers 0x%x, fatal error. Quitting...\n", address);
+        clean_reboot(); // TODO: fail gracefully?
     }
 #endif
 }
@@ -99,8 +149,6 @@ static void install_handlers(void) {
                 dst[i] = src[i];
 }
 
-#include "cp15-arm.h"
-
 void interrupts_init(void) {
     // BCM2835 manual, section 7.5: turn off all GPIO interrupts.
     PUT32(INTERRUPT_DISABLE_1, 0xffffffff);
@@ -111,6 +159,7 @@ void interrupts_init(void) {
     // setup the interrupt vectors.
     install_handlers();
     int_intialized_p = 1;
+    fault_stats_init();
 }
 
 // Helpers for extracting data from the data fault status register
@@ -206,6 +255,19 @@ void printDataAbort(unsigned pc) {
         printk("Address: 0x%x (invalid!)\n", get_fault_address_reg());
     }
 
+    /* What the table walk makes of the address now (c7 translate) */
+    if (fault_status_has_valid_far(faultval)) {
+        unsigned far = get_fault_address_reg(),
+                 par = mmu_hw_translate(far, HW_XLATE_PRIV, HW_XLATE_READ);
+        if (HW_XLATE_ABORTED(par)) {
+            printk("Walk:	 fault 0b");
+            printBinary(HW_XLATE_STATUS(par), 5);
+            printk(" on a privileged read\n");
+        } else {
+            printk("Walk:	 pa 0x%x\n", hw_xlate_pa(par, far));
+        }
+    }
+
     /* Domain */
     if (fault_status_has_valid_domain(faultval)) {
         printk("Domain:\t %d\n", WFAULT_DOMAIN(faultval));
@@ -0,0 +1,132 @@
+/*
+ * File: LZ77 page codec
+ * ---
+ * See lz.h. The hash table is static rather than on the stack (the kernel
+ * build caps stack frames); swap calls it with interrupts off.
+ */
+#include "rpi.h"
+#include "lz.h"
+
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+
+static uint16_t table[1 << LZ_HASH_BITS];
+
+// byte loads: page contents are not word aligned at every position.
+static inline uint32_t rd32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline unsigned hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// a nibble's overflow: runs of 255, then the rest.
+static uint8_t *put_len(uint8_t *op, unsigned n) {
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+// one sequence: nlit literals, then a match of mlen at off back (none if mlen
+// is 0). returns the new output position, 0 if it won't fit before oend.
+static uint8_t *emit(uint8_t *op, uint8_t *oend, const uint8_t *lit, unsigned nlit,
+                     unsigned off, unsigned mlen) {
+    // token, offset and the worst case for both length runs.
+    if (op + 1 + nlit + nlit / 255 + 1 + 2 + mlen / 255 + 1 > oend)
+        return 0;
+
+    unsigned ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+    *op++ = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+    if (nlit >= 15)
+        op = put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen)
+        return op;
+
+    *op++ = off & 0xff;
+    *op++ = off >> 8;
+    if (ml >= 15)
+        op = put_len(op, ml - 15);
+    return op;
+}
+
+unsigned lz_compress(const uint8_t *src, unsigned n, uint8_t *dst, unsigned cap) {
+    demand(n <= LZ_MAX_INPUT, input too big for 16-bit offsets);
+    memset(table, 0, sizeof table);
+
+    uint8_t *op = dst, *oend = dst + cap;
+    unsigned anchor = 0, i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t v = rd32(src + i);
+        unsigned h = hash(v), cand = table[h];
+        table[h] = i;
+        if (cand >= i || rd32(src + cand) != v) {
+            i++;
+            continue;
+        }
+
+        unsigned m = LZ_MIN_MATCH;
+        while (i + m < n && src[cand + m] == src[i + m])
+            m++;
+        if (!(op = emit(op, oend, src + anchor, i - anchor, i - cand, m)))
+            return 0;
+        i += m;
+        anchor = i;
+    }
+    if (!(op = emit(op, oend, src + anchor, n - anchor, 0, 0)))
+        return 0;
+    return op - dst;
+}
+
+// a length nibble plus its overflow bytes; 0 if they run off the input.
+static const uint8_t *get_len(const uint8_t *ip, const uint8_t *iend, unsigned *n) {
+    if (*n != 15)
+        return ip;
+    uint8_t b;
+    do {
+        if (ip >= iend)
+            return 0;
+        b = *ip++;
+        *n += b;
+    } while (b == 255);
+    return ip;
+}
+
+int lz_decompress(const uint8_t *src, unsigned clen, uint8_t *dst, unsigned n) {
+    const uint8_t *ip = src, *iend = src + clen;
+    unsigned o = 0;
+
+    while (ip < iend) {
+        unsigned tok = *ip++, nlit = tok >> 4;
+        if (!(ip = get_len(ip, iend, &nlit)) || nlit > (unsigned)(iend - ip) || nlit > n - o)
+            return 0;
+        memcpy(dst + o, ip, nlit);
+        ip += nlit;
+        o += nlit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return 0;
+        unsigned off = ip[0] | ip[1] << 8, mlen = tok & 15;
+        ip += 2;
+        if (!(ip = get_len(ip, iend, &mlen)))
+            return 0;
+        mlen += LZ_MIN_MATCH;
+        if (!off || off > o || mlen > n - o)
+            return 0;
+        // the match may overlap itself (a run with period off): copy from
+        // its start in chunks that never do, each twice the last.
+        const uint8_t *m = dst + o - off;
+        while (mlen) {
+            unsigned k = dst + o - m < mlen ? dst + o - m : mlen;
+            memcpy(dst + o, m, k);
+            o += k;
+            mlen -= k;
+        }
+    }
+    return o == n;
+}
@@ -0,0 +1,28 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+
+/*
+ * Small LZ77 codec for page contents
+ * ---
+ * The LZ4 block format, more or less: each sequence is a token (literal
+ * count << 4 | match length - 4), extra length bytes when a nibble is 15,
+ * the literals, then a 2-byte little-endian match offset and the match's extra
+ * length bytes. The last sequence is literals only. Matches are found with a
+ * single hash table probe per position, so compression is one pass and
+ * decompression is byte copies. Speed matters more than ratio for swap.
+ *
+ * Inputs are at most LZ_MAX_INPUT bytes, so every offset fits in 16 bits.
+ */
+#include <stdint.h>
+
+#define LZ_MAX_INPUT    (64 * 1024)
+
+// compress n bytes of src into dst; returns the compressed size, or 0 if it
+// would need more than cap bytes.
+unsigned lz_compress(const uint8_t *src, unsigned n, uint8_t *dst, unsigned cap);
+
+// decompress clen bytes of src into dst; returns 1 if they decode to exactly
+// n bytes, 0 on corrupt input.
+int lz_decompress(const uint8_t *src, unsigned clen, uint8_t *dst, unsigned n);
+
+#endif
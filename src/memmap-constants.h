@@ -33,6 +33,23 @@
 #define ADDRESSES_PER_64KB  0x10000
 #define ADDRESSES_PER_4KB   0x1000
 
+// The BCM2835 peripheral window (GPIO, UART, timer, ...), see the peripherals manual 1.2.3
+#define PERIPHERAL_BASE     0x20000000
+#define PERIPHERAL_SIZE     0x1000000
+
+// RAM the ARM sees: the top of the 512MB goes to the GPU (config.txt's gpu_mem).
+// Physical frames (frame.c) are handed out from [FRAME_START, RAM_SIZE), so the
+// kmalloc heap has to stay below FRAME_START. The simulator overrides both.
+#ifndef RAM_SIZE
+#define RAM_SIZE            0x10000000
+#endif
+#ifndef FRAME_START
+#define FRAME_START         0x1000000
+#endif
+// 1MB of kernel VA (TTBR1, just above the peripherals) where frame_kmap maps a
+// frame the kernel has no other mapping of.
+#define FRAME_WINDOW        (PERIPHERAL_BASE + PERIPHERAL_SIZE)
+
 // Where the kernel and other executables ought to start (in VM)
 #define KERNEL_BASE         0x8000
 #define ARMBASE             0x408000
@@ -15,9 +15,15 @@
 #include "mmu.h"
 #include "cp15-arm.h"
 #include "helper-macros.h"
-
-// Twiddle this flag to print out info when modifications are made to the page table
-#define DEBUG_PRINT_DESCRIPTORS 1
+#include "pt-alloc.h"
+#include "cache.h"
+
+// Twiddle this flag to print out info when modifications are made to the page table.
+// Off by default: the fault paths (demand paging, COW, dirty tracking, swap)
+// map through here, and printing from an abort handler is far too slow.
+#ifndef DEBUG_PRINT_DESCRIPTORS
+#define DEBUG_PRINT_DESCRIPTORS 0
+#endif
 
 /* Print and validity check functions */
 
@@ -26,9 +32,11 @@ static void section_check_valid(sec_desc_t *f) {
     assert(f->tag == 0b10);
     assert(f->S == 0);
     assert(f->IMP == 0);
-    assert(f->C == 0);
-    assert(f->B == 0);
-    assert(f->super == 0);
+    // supersections: bits 23:20 of the base are sbz, domain is always 0 (b4-27)
+    if (f->super) {
+        assert((f->sec_base_addr & 0xF) == 0);
+        assert(f->domain == 0);
+    }
 }
 
 static void section_check(void) {
@@ -60,6 +68,7 @@ void section_print(sec_desc_t *f) {
     printk("\t  --> va=0x%8x\n", f->sec_base_addr<<20);
     printk("\t           76543210\n");
 
+    print_field(f, super);
     print_field(f, nG);
     print_field(f, S);
     print_field(f, APX);
@@ -133,7 +142,7 @@ void lg_page_desc_print (lg_page_desc_t *pte) {
 
 /* Page table bookkeeping */
 
-// Naive: we assume a single page table, which forces it to be 4096 entries.
+// A table covering the whole address space is 4096 entries.
 // Why 4096:
 //      - ARM = 32-bit addresses.
 //      - 2^32 = 4GB
@@ -141,18 +150,23 @@ void lg_page_desc_print (lg_page_desc_t *pte) {
 //      - there are 4096 1MB sections in 4GB (4GB = 1MB * 4096).
 //      - therefore page table must have 4096 entries.
 //
+// With TTBCR.N > 0, TTBR0 only translates the bottom 4GB >> N, so its table
+// needs only 4096 >> N entries and is aligned to its size (pg. B4-41). The
+// caller must not use it for addresses above that.
+//
 // Note: If you want 4k pages, need to use the ARM 2-level page table format.
 // These also map 1MB (otherwise hard to mix 1MB sections and 4k pages).
-fld_t *mmu_pt_alloc(unsigned sz) {
-    demand(sz = 4096, we only handling a single page table right now);
+fld_t *mmu_pt_alloc(unsigned n) {
+    AssertNow(sizeof(fld_t) == 4);
+    unsigned sz = n * sizeof(fld_t);
 
-    // first-level page table is 4096 entries.
-    fld_t *pt = kmalloc_aligned(4096 * 4, 1<<14);
+    fld_t *pt = pt_l1_alloc(sz); // zero-filled, reused after mmu_pt_free
 #if DEBUG_PRINT_DESCRIPTORS == 1
     printk("Note: page table made at address %x\n", pt); // Test the address, where is it?
 #endif
-    AssertNow(sizeof *pt == 4);
-    demand(is_aligned((unsigned)pt, 14), must be 14-bit aligned!);
+    demand(is_aligned(mmu_ptr_to_pa(pt), sz), must be aligned to its size!);
+    // the pool may hand back a table that was never mmu_pt_free'd.
+    mmu_xlate_inval();
     return pt;
 }
 
@@ -237,37 +251,28 @@ static sec_desc_t mk_section(void) {
 static fld_t mk_coarse_page_table(int domain) {
     // Coarse page tables are 1KB in size, with 256 4-byte (32-bit) entries. (Mapping out an entire 1MB section).
     // They have to be 10-bit aligned for the translation base, which is 22 bits
-    fld_t *pt = kmalloc_aligned(256 * 4, 0b1<<10); // kmalloc() sets to 0, mind!
+    fld_t *pt = pt_coarse_alloc(); // zero-filled, from the pool (pt-alloc.c)
     // printk("coarse pt made at address %x\n", pt); // Test the address, where is it?
     AssertNow(sizeof *pt == 4);
+    AssertNow(256 * sizeof *pt == PT_COARSE_SIZE);
     
     fld_t f; // The actual fld to return
     memset(&f, 0, sizeof(fld_t)); // Unused fields can have 0 as default
 
     coarse_pt_desc_t *entry = (coarse_pt_desc_t *)&f; // Cast + indirection to do some work
     entry->tag = FLD_COARSE_PT_TAG;
-    entry->base = (unsigned)pt >> 10; // Take upper 22 bits (IMPORTANT)
+    entry->base = mmu_ptr_to_pa(pt) >> 10; // Take upper 22 bits (IMPORTANT)
     entry->domain = domain;
     
     assert(f.tag == FLD_COARSE_PT_TAG);
     return f;
 }
 
-// Create and return a small page table entry.
-static sm_page_desc_t mk_sm_page() {
-    sm_page_desc_t pte;
-    memset(&pte, 0, sizeof(sm_page_desc_t));
-    // The tag is set as a 1-bit field and read as a 2-bit one, pg. B4-31
-    pte.tag = SLD_SM_PAGE_BIT_1; 
-    return pte;
-}
-
-// Create and return a large page table entry.
-static lg_page_desc_t mk_lg_page() {
-    lg_page_desc_t pte;
-    memset(&pte, 0, sizeof(lg_page_desc_t));
-    pte.tag = SLD_LG_PAGE_TAG;
-    return pte;
+// Write a whole descriptor (see the mmu_*_desc encoders in mmu.h) with one
+// 32-bit store instead of a read-modify-write per field.
+static inline void desc_wr(void *d, uint32_t v) {
+    AssertNow(sizeof(fld_t) == sizeof v && sizeof(sld_t) == sizeof v);
+    __builtin_memcpy(d, &v, sizeof v);
 }
 
 /* Virtual address to key/index functions */
@@ -305,30 +310,50 @@ static fld_t *mmu_first_level_lookup(fld_t *pt, uint32_t va) {
 // by the second-level table index portion of the virtual address.
 static void *mmu_second_level_lookup(void *pde, uint32_t va) {
     // Create a pointer to the start of the coarse page table
-    sld_t *cpt = (sld_t *)(((coarse_pt_desc_t *)pde)->base << 10); // TODO: define 10 offset
+    sld_t *cpt = mmu_pa_to_ptr(((coarse_pt_desc_t *)pde)->base << 10); // TODO: define 10 offset
     return &cpt[get_second_level_table_idx(va)];
 }
 
 /* Modifying page table functions */
 
 fld_t *mmu_map_section(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags) {
-    assert(is_aligned(va, 20));
-    assert(is_aligned(pa, 20));
+    assert(is_aligned(va, SECTION_SIZE));
+    assert(is_aligned(pa, SECTION_SIZE));
 
     sec_desc_t *pde = (sec_desc_t *)mmu_first_level_lookup(pt, va);
     demand(!pde->tag, already set);
-    *pde = mk_section();
-
-    pde->nG = FGET_NG(flags);
-    pde->S = FGET_S(flags);
-    pde->APX = FGET_APX(flags);
-    pde->TEX = TEX_DEFAULT; 
-    pde->AP = FGET_AP(flags);
-    pde->domain = domain;
-    pde->XN = FGET_XN(flags);
-    pde->C = FGET_C(flags);
-    pde->B = FGET_B(flags);
-    pde->sec_base_addr = pa >> 20;
+    demand(FGET_MEM(flags) <= MEM_DEVICE, no such memory type);
+    desc_wr(pde, mmu_sec_desc(pa, domain, flags));
+
+#if DEBUG_PRINT_DESCRIPTORS == 1
+    section_print(pde);
+#endif
+    return (fld_t *)pde;
+}
+
+/*
+ * function: map a supersection in virtual memory
+ * ---
+ * Maps a 16MB supersection: one TLB entry for 16x the memory of a section. The
+ * first-level table still indexes by 1MB, so the same descriptor (with the super
+ * bit set) is repeated in all 16 entries covering the region, much like large
+ * pages in a coarse table. Supersections have no domain field; the hardware
+ * always checks them against domain 0 (see pg. B4-27).
+ *
+ * @param pt: The page table
+ * @param va: The virtual address to be mapped (16MB aligned)
+ * @param pa: The physical address to map to (16MB aligned)
+ * @return: The first of the 16 first-level descriptors
+ */
+fld_t *mmu_map_supersection(fld_t *pt, uint32_t va, uint32_t pa, int flags) {
+    assert(is_aligned(va, SUPERSECTION_SIZE));
+    assert(is_aligned(pa, SUPERSECTION_SIZE));
+
+    sec_desc_t *pde = (sec_desc_t *)mmu_first_level_lookup(pt, va);
+    for (int i = 0; i < 16; i++) demand(!pde[i].tag, already set);
+    demand(FGET_MEM(flags) <= MEM_DEVICE, no such memory type);
+
+    mmu_desc_fill16(pde, mmu_supersec_desc(pa, flags));
 
 #if DEBUG_PRINT_DESCRIPTORS == 1
     section_print(pde);
@@ -336,6 +361,29 @@ fld_t *mmu_map_section(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
     return (fld_t *)pde;
 }
 
+// Clear all 16 entries of the supersection containing va.
+void mmu_unmap_supersection(fld_t *pt, uint32_t va) {
+    sec_desc_t *pde = (sec_desc_t *)mmu_lookup(pt, va);
+    demand(pde && pde->tag == FLD_SECTION_TAG && pde->super, not a supersection);
+    mmu_unmap(pt, va);
+}
+
+/*
+ * function: look up the first-level descriptor for a virtual address
+ * ---
+ * Returns the section, supersection or coarse table descriptor covering va, or
+ * 0 if va is unmapped. For a supersection this is the first of its 16 copies so
+ * callers always see the same entry for any address in the 16MB.
+ */
+fld_t *mmu_lookup(fld_t *pt, uint32_t va) {
+    fld_t *pde = mmu_first_level_lookup(pt, va);
+    if (pde->tag == FLD_FAULT_TAG)
+        return 0;
+    if (pde->tag == FLD_SECTION_TAG && ((sec_desc_t *)pde)->super)
+        return mmu_first_level_lookup(pt, va & ~(SUPERSECTION_SIZE - 1));
+    return pde;
+}
+
 /*
  * function: map a small page in virtual memory
  * ---
@@ -348,8 +396,9 @@ fld_t *mmu_map_section(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
  */
 sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags) {
     // Small pages map out 2^12 bytes (4KB) of memory. Make sure addresses are aligned.
-    assert(is_aligned(va, 12));
-    assert(is_aligned(pa, 12));
+    assert(is_aligned(va, SM_PAGE_SIZE));
+    assert(is_aligned(pa, SM_PAGE_SIZE));
+    demand(FGET_MEM(flags) <= MEM_DEVICE, no such memory type);
 
     // First-level descriptor/page directory entry
     fld_t *pde = mmu_first_level_lookup(pt, va);
@@ -368,17 +417,7 @@ sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
     sm_page_desc_t *pte = mmu_second_level_lookup(pde, va);
     
     assert(pte->tag == FLD_FAULT_TAG);
-    *pte = mk_sm_page();
-
-    pte->nG = FGET_NG(flags);
-    pte->S = FGET_S(flags);
-    pte->APX = FGET_APX(flags);
-    pte->TEX = TEX_DEFAULT; 
-    pte->AP = FGET_AP(flags);
-    pte->XN = FGET_XN(flags);
-    pte->C = FGET_C(flags);
-    pte->B = FGET_B(flags);
-    pte->base = pa >> 12; // Base address is upper 20 bits
+    desc_wr(pte, mmu_sm_page_desc(pa, flags));
 
 #if DEBUG_PRINT_DESCRIPTORS == 1
     printk("flags: %b\n", flags);
@@ -387,10 +426,6 @@ sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
     return (sld_t *)pte;
 }
 
-// Large pages need to be replicated 16 times, and there are 256 entries in a coarse page table.
-// We shouldn't allocate a large page at greater than cpt[256 - 16 = 240], or we'll bleed past the end.
-#define MAX_LARGE_PAGE_IDX 240
-
 /*
  * function: map a large page in virtual memory
  * ---
@@ -398,6 +433,11 @@ sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
  * table for the hardware lookup (see pg. B4-31, the low order bits of the second-level
  * table index overlap with the page index, so we want any variation of those bits to
  * correspond with a single large page entry).
+ *
+ * A 64KB-aligned va puts the replicas at a 16-entry boundary of the coarse table
+ * (index bits [15:12] are zero), so the 16 slots of a 1MB region each hold one
+ * large page and none of them runs past the end of the table, the last one
+ * (cpt[240..255]) included.
  * 
  * @param pt: The page table
  * @param va: The virtual address to be mapped
@@ -405,13 +445,12 @@ sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
  * @return: A generic second-level descriptor (sld_t *); the large page table entry
  */
 sld_t *mmu_map_lg_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags) {
-    // Large pages map out 2^16 bytes (16KB) of memory. Make sure addresses are aligned.
-    assert(is_aligned(va, 16));
-    assert(is_aligned(pa, 16));
-
-    // Avoid allocating large pages towards the end of a coarse page table. A compromise;
-    // could track large pages that bleed across multiple coarse page tables if we wanted.
-    assert(get_second_level_table_idx(va) <= MAX_LARGE_PAGE_IDX);
+    // Large pages map out 2^16 bytes (64KB) of memory. Make sure addresses are aligned;
+    // this is also what keeps the 16 replicas inside one coarse table.
+    assert(is_aligned(va, LG_PAGE_SIZE));
+    assert(is_aligned(pa, LG_PAGE_SIZE));
+    assert(get_second_level_table_idx(va) % 16 == 0);
+    demand(FGET_MEM(flags) <= MEM_DEVICE, no such memory type);
 
     // Grab the first-level descriptor/page directory entry (PDE)
     fld_t *pde = mmu_first_level_lookup(pt, va);
@@ -430,19 +469,7 @@ sld_t *mmu_map_lg_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
     lg_page_desc_t *pte = mmu_second_level_lookup(pde, va);
     
     for (int i = 0; i < 16; i++) assert(pte[i].tag == FLD_FAULT_TAG);
-    for (int i = 0; i < 16; i++) {
-        pte[i] = mk_lg_page();
-
-        pte[i].XN = FGET_XN(flags);
-        pte[i].TEX = TEX_DEFAULT; 
-        pte[i].nG = FGET_NG(flags);
-        pte[i].S = FGET_S(flags);
-        pte[i].APX = FGET_APX(flags);
-        pte[i].AP = FGET_AP(flags);
-        pte[i].C = FGET_C(flags);
-        pte[i].B = FGET_B(flags);
-        pte[i].base = pa >> 16; // Base address is upper 16 bits
-    }
+    mmu_desc_fill16(pte, mmu_lg_page_desc(pa, flags));
 
 #if DEBUG_PRINT_DESCRIPTORS == 1
     printk("flags: %b\n", flags);
@@ -451,26 +478,611 @@ sld_t *mmu_map_lg_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flag
     return (sld_t *)pte;
 }
 
+// Are the n first-level entries starting at va all unmapped?
+static int fld_range_empty(fld_t *pt, uint32_t va, unsigned n) {
+    fld_t *pde = mmu_first_level_lookup(pt, va);
+    for (int i = 0; i < n; i++)
+        if (pde[i].tag != FLD_FAULT_TAG)
+            return 0;
+    return 1;
+}
+
+// Clean first-level entries [first, last] of pt and the coarse tables they
+// point to, so the table walk sees whatever was written there: line by line,
+// or the whole D-cache if that adds up to more than it holds (cache.h).
+static void pt_clean(fld_t *pt, unsigned first, unsigned last) {
+    uint32_t bytes = (last - first + 1) * sizeof *pt;
+    for (unsigned i = first; i <= last; i++)
+        if (pt[i].tag == FLD_COARSE_PT_TAG)
+            bytes += PT_COARSE_SIZE;
+    if (bytes > CACHE_RANGE_MAX) {
+        cp15_dcache_clean();
+        return;
+    }
+
+    cache_clean_range(&pt[first], &pt[last + 1]);
+    for (unsigned i = first; i <= last; i++)
+        if (pt[i].tag == FLD_COARSE_PT_TAG) {
+            uint8_t *cpt = mmu_second_level_lookup(&pt[i], 0);
+            cache_clean_range(cpt, cpt + PT_COARSE_SIZE);
+        }
+}
+
+void mmu_pt_clean(fld_t *pt, unsigned n_entries) {
+    if (n_entries)
+        pt_clean(pt, 0, n_entries - 1);
+}
+
+// mmu_sync_pt for a batch that only wrote descriptors under [va, va+len).
+static void mmu_sync_range(fld_t *pt, uint32_t va, uint32_t len) {
+    pt_clean(pt, get_first_level_table_idx(va), get_first_level_table_idx(va + len - 1));
+    mmu_sync_tlb();
+}
+
+/*
+ * function: map a range of virtual memory
+ * ---
+ * Maps [va, va+len) to [pa, pa+len) with the largest page size that fits at each
+ * point: supersections where va and pa are 16MB aligned (only in domain 0, the
+ * one domain supersections can use), sections where they are 1MB aligned (and the
+ * first-level slot is not already a coarse page table), large pages where they
+ * are 64KB aligned, and small pages to fill in around the edges. Fewer, bigger pages use fewer TLB
+ * entries for the same memory. The page table is synced once at the end instead
+ * of after every descriptor, and only the lines holding the range's descriptors
+ * are cleaned.
+ *
+ * @param pt: The page table
+ * @param va: The start of the virtual range (4KB aligned)
+ * @param pa: The physical address to map it to (4KB aligned)
+ * @param len: Length of the range in bytes (multiple of 4KB)
+ * @return: The number of descriptors (TLB entries) used to map the range
+ */
+unsigned mmu_map_range(fld_t *pt, uint32_t va, uint32_t pa, uint32_t len, int domain, int flags) {
+    demand(is_aligned(va | pa | len, SM_PAGE_SIZE), range must be 4KB aligned);
+    if (!len)
+        return 0;
+
+    uint32_t va0 = va, len0 = len;
+    unsigned n = 0;
+    while (len) {
+        uint32_t sz;
+        if (domain == 0 && is_aligned(va | pa, SUPERSECTION_SIZE) && len >= SUPERSECTION_SIZE
+                && fld_range_empty(pt, va, 16)) {
+            mmu_map_supersection(pt, va, pa, flags);
+            sz = SUPERSECTION_SIZE;
+        } else if (is_aligned(va | pa, SECTION_SIZE) && len >= SECTION_SIZE
+                && mmu_first_level_lookup(pt, va)->tag == FLD_FAULT_TAG) {
+            mmu_map_section(pt, va, pa, domain, flags);
+            sz = SECTION_SIZE;
+        } else if (is_aligned(va | pa, LG_PAGE_SIZE) && len >= LG_PAGE_SIZE) {
+            mmu_map_lg_page(pt, va, pa, domain, flags);
+            sz = LG_PAGE_SIZE;
+        } else {
+            mmu_map_sm_page(pt, va, pa, domain, flags);
+            sz = SM_PAGE_SIZE;
+        }
+        va += sz;
+        pa += sz;
+        len -= sz;
+        n++;
+    }
+
+    mmu_sync_range(pt, va0, len0);
+    return n;
+}
+
+/* Changing existing mappings */
+
+/*
+ * Find the descriptor mapping va: sets *d to the first descriptor (the first of
+ * the 16 replicas for supersections and large pages) and *n to the number of
+ * replicas. Returns the number of bytes the mapping covers, 0 if unmapped.
+ */
+static unsigned mmu_find(fld_t *pt, uint32_t va, void **d, unsigned *n) {
+    fld_t *pde = mmu_lookup(pt, va);
+    if (!pde)
+        return 0;
+
+    if (pde->tag == FLD_SECTION_TAG) {
+        *d = pde;
+        if (((sec_desc_t *)pde)->super) {
+            *n = 16;
+            return SUPERSECTION_SIZE;
+        }
+        *n = 1;
+        return SECTION_SIZE;
+    }
+
+    assert(pde->tag == FLD_COARSE_PT_TAG);
+    sld_t *pte = mmu_second_level_lookup(pde, va);
+    if (pte->tag1 == SLD_SM_PAGE_BIT_1) {
+        *d = pte;
+        *n = 1;
+        return SM_PAGE_SIZE;
+    }
+    if (pte->tag0) { // 0b01: large page
+        *d = mmu_second_level_lookup(pde, va & ~(LG_PAGE_SIZE - 1));
+        *n = 16;
+        return LG_PAGE_SIZE;
+    }
+    return 0;
+}
+
+// Make n rewritten descriptors at d visible to the table walk and drop the TLB
+// entry for va, tagged with the current ASID in case the mapping is non-global.
+// Assumes pt is the active page table (or that the caller flushes the ASID).
+static void mmu_sync_entry(void *d, unsigned n, uint32_t va) {
+    uint32_t asid = cp15_procid_rd() & 0xff;
+    mmu_sync_pte_mva(d, n * sizeof(fld_t), (va & ~(SM_PAGE_SIZE - 1)) | asid);
+}
+
+// The table walk does not look in the D-cache (TTBR0 C=0), so with it on, a
+// new mapping in cacheable memory is invisible until cleaned. Cleans the
+// whole coarse table, which the map may just have allocated, then the pde.
+void mmu_sync_map(fld_t *pt, uint32_t va) {
+    fld_t *pde = mmu_lookup(pt, va);
+    if (!pde)
+        return;
+    unsigned n = 1;
+    if (pde->tag == FLD_COARSE_PT_TAG) {
+        uint32_t asid = cp15_procid_rd() & 0xff;
+        mmu_sync_pte_mva(mmu_second_level_lookup(pde, 0), PT_COARSE_SIZE,
+            (va & ~(SM_PAGE_SIZE - 1)) | asid);
+    } else if (((sec_desc_t *)pde)->super)
+        n = 16;
+    mmu_sync_entry(pde, n, va);
+}
+
+// 1 if none of the 256 entries of the coarse table pde points to are mapped.
+static int coarse_table_empty(fld_t *pde) {
+    uint32_t *cpt = mmu_second_level_lookup(pde, 0);
+    for (unsigned i = 0; i < 256; i++)
+        if (cpt[i])
+            return 0;
+    return 1;
+}
+
+/*
+ * function: unmap virtual memory
+ * ---
+ * Removes whichever mapping (supersection, section, large or small page) covers
+ * va. Only the one TLB entry is invalidated. A coarse page table left empty is
+ * unhooked from the first-level table and returned to the pool.
+ *
+ * @return: The number of bytes unmapped; 0 if va was not mapped
+ */
+unsigned mmu_unmap(fld_t *pt, uint32_t va) {
+    void *d;
+    unsigned n, sz = mmu_find(pt, va, &d, &n);
+    if (!sz)
+        return 0;
+
+    memset(d, 0, n * sizeof(fld_t));
+    mmu_sync_entry(d, n, va);
+    mmu_xlate_inval();
+
+    fld_t *pde = mmu_first_level_lookup(pt, va);
+    if (pde->tag == FLD_COARSE_PT_TAG && coarse_table_empty(pde)) {
+        void *cpt = mmu_second_level_lookup(pde, 0);
+        memset(pde, 0, sizeof *pde);
+        mmu_sync_entry(pde, 1, va);
+        pt_coarse_free(cpt);
+    }
+    return sz;
+}
+
+// Tear down a whole address space: every coarse table hanging off pt, then pt
+// itself, go back to the pools. pt must not be live in TTBR0, and the caller
+// deals with stale TLB entries (e.g., invalidate the ASID).
+void mmu_pt_free(fld_t *pt, unsigned n) {
+    for (unsigned i = 0; i < n; i++)
+        if (pt[i].tag == FLD_COARSE_PT_TAG)
+            pt_coarse_free(mmu_second_level_lookup(&pt[i], 0));
+    pt_l1_free(pt, n * sizeof *pt);
+    // a later mmu_pt_alloc can hand back the same pointer.
+    mmu_xlate_inval();
+}
+
+/*
+ * function: point an existing mapping at a different physical address
+ * ---
+ * Keeps the page size, domain and flags of the mapping covering va; pa must be
+ * aligned to that page size.
+ *
+ * @return: The size of the mapping changed; 0 if va was not mapped
+ */
+unsigned mmu_remap(fld_t *pt, uint32_t va, uint32_t pa) {
+    void *d;
+    unsigned n, sz = mmu_find(pt, va, &d, &n);
+    if (!sz)
+        return 0;
+    demand(is_aligned(pa, sz), pa not aligned to the page size);
+
+    for (int i = 0; i < n; i++) {
+        switch (sz) {
+        case SUPERSECTION_SIZE:
+        case SECTION_SIZE:      ((sec_desc_t *)d)[i].sec_base_addr = pa >> 20; break;
+        case LG_PAGE_SIZE:      ((lg_page_desc_t *)d)[i].base = pa >> 16; break;
+        case SM_PAGE_SIZE:      ((sm_page_desc_t *)d)[i].base = pa >> 12; break;
+        }
+    }
+    mmu_sync_entry(d, n, va);
+    mmu_xlate_inval();
+    return sz;
+}
+
+/*
+ * function: change the permissions of an existing mapping
+ * ---
+ * Rewrites the access permission and execute-never bits (AP, APX, XN) of the
+ * mapping covering va from flags, same encoding as the mmu_map_* calls. Memory
+ * attributes and the global bit are left alone.
+ *
+ * @return: The size of the mapping changed; 0 if va was not mapped
+ */
+unsigned mmu_protect(fld_t *pt, uint32_t va, int flags) {
+    void *d;
+    unsigned n, sz = mmu_find(pt, va, &d, &n);
+    if (!sz)
+        return 0;
+
+    for (int i = 0; i < n; i++) {
+        switch (sz) {
+        case SUPERSECTION_SIZE:
+        case SECTION_SIZE: {
+            sec_desc_t *e = &((sec_desc_t *)d)[i];
+            e->AP = FGET_AP(flags);
+            e->APX = FGET_APX(flags);
+            e->XN = FGET_XN(flags);
+            break;
+        }
+        case LG_PAGE_SIZE: {
+            lg_page_desc_t *e = &((lg_page_desc_t *)d)[i];
+            e->AP = FGET_AP(flags);
+            e->APX = FGET_APX(flags);
+            e->XN = FGET_XN(flags);
+            break;
+        }
+        case SM_PAGE_SIZE: {
+            sm_page_desc_t *e = &((sm_page_desc_t *)d)[i];
+            e->AP = FGET_AP(flags);
+            e->APX = FGET_APX(flags);
+            e->XN = FGET_XN(flags);
+            break;
+        }
+        }
+    }
+    mmu_sync_entry(d, n, va);
+    mmu_xlate_inval();
+    return sz;
+}
+
+// Descriptor fields back to the mmu_map_* flag encoding (AP with the
+// F_NO_ACCESS "set" bit, an explicit memory type rather than MEM_DEFAULT).
+static int mk_flags(unsigned ap, unsigned apx, unsigned ng, unsigned xn,
+                    unsigned tex, unsigned c, unsigned b, unsigned s) {
+    // the MEM_* type whose TEX/C/B these are, by table: this is on the
+    // mmu_translate miss path. Every descriptor the mmu_map_* calls build has
+    // one; anything else comes back as MEM_UNKNOWN rather than a guess, which
+    // would change the memory type of whatever gets rebuilt from these flags.
+    static uint8_t mem_type[32], filled;
+    if (!filled) {
+        for (unsigned m = 0; m < 32; m++)
+            mem_type[m] = MEM_UNKNOWN;
+        for (unsigned t = MEM_DEVICE; t > MEM_DEFAULT; t--)
+            mem_type[mmu_mem_attr(F_MEM(t), 0)] = t;
+        filled = 1;
+    }
+    unsigned t = mem_type[tex << 2 | c << 1 | b];
+
+    return F_NO_ACCESS | ap | F_MEM(t)
+        | (apx ? F_SET_APX : 0) | (ng ? F_NOT_GLOBAL : 0)
+        | (s ? F_SHARED : 0) | (xn ? F_EXEC_NEVER : 0);
+}
+
+/* Translating */
+
+/*
+ * Software translation cache: direct-mapped by 4KB page of va, each entry
+ * remembering one whole mapping (so a 1MB section can fill several slots).
+ * Rather than finding the entries a table change makes stale, every change
+ * bumps xlate_gen and entries from older generations miss. Tables share
+ * coarse tables with kernel_pt (env.h), so a change through one pt can change
+ * what another translates to: invalidating everything is also the only simple
+ * correct choice. Faults are not cached, so the mmu_map_* calls, which only
+ * fill in unmapped entries, don't need to invalidate anything.
+ */
+#define XLATE_ENTRIES 64
+
+static struct xlate_ent {
+    fld_t *pt;
+    uint32_t va,        // start of the mapping
+             gen;
+    mmu_xlate_t x;      // pa is the start of the mapping
+} xlate_cache[XLATE_ENTRIES];
+static uint32_t xlate_gen = 1;  // 0 never matches, so zeroed entries are empty
+static mmu_xlate_stats_t xlate_stats;
+
+void mmu_xlate_inval(void) {
+    xlate_stats.n_invals++;
+    if (!++xlate_gen) {
+        memset(xlate_cache, 0, sizeof xlate_cache);
+        xlate_gen = 1;
+    }
+}
+
+mmu_xlate_stats_t mmu_xlate_stats(void) {
+    return xlate_stats;
+}
+
+/*
+ * The walk itself, on whole descriptor words rather than bitfields (bit
+ * positions from the encoders in mmu.h; pg. B4-27, B4-31). Sets x->pa to the
+ * start of the mapping.
+ */
+static unsigned xlate_walk(fld_t *pt, uint32_t va, mmu_xlate_t *x) {
+    uint32_t d = ((uint32_t *)pt)[get_first_level_table_idx(va)];
+
+    if ((d & 0b11) == FLD_SECTION_TAG) {
+        if (d >> 18 & 1) {
+            x->kind = MMU_KIND_SUPERSECTION;
+            x->size = SUPERSECTION_SIZE;
+        } else {
+            x->kind = MMU_KIND_SECTION;
+            x->size = SECTION_SIZE;
+        }
+        x->pa = d & ~(x->size - 1);
+        x->flags = mk_flags(d >> 10 & 3, d >> 15 & 1, d >> 17 & 1, d >> 4 & 1,
+                            d >> 12 & 7, d >> 3 & 1, d >> 2 & 1, d >> 16 & 1);
+        return x->size;
+    }
+    if ((d & 0b11) != FLD_COARSE_PT_TAG)
+        return x->kind = x->size = 0;
+
+    uint32_t *cpt = mmu_pa_to_ptr(d & ~(PT_COARSE_SIZE - 1));
+    uint32_t e = cpt[get_second_level_table_idx(va)];
+    if (e & 0b10) {
+        x->kind = MMU_KIND_SM_PAGE;
+        x->size = SM_PAGE_SIZE;
+        x->flags = mk_flags(e >> 4 & 3, e >> 9 & 1, e >> 11 & 1, e & 1,
+                            e >> 6 & 7, e >> 3 & 1, e >> 2 & 1, e >> 10 & 1);
+    } else if (e & 0b01) {
+        x->kind = MMU_KIND_LG_PAGE;
+        x->size = LG_PAGE_SIZE;
+        x->flags = mk_flags(e >> 4 & 3, e >> 9 & 1, e >> 11 & 1, e >> 15 & 1,
+                            e >> 12 & 7, e >> 3 & 1, e >> 2 & 1, e >> 10 & 1);
+    } else
+        return x->kind = x->size = 0;
+    x->pa = e & ~(x->size - 1);
+    return x->size;
+}
+
+/*
+ * function: translate a virtual address in software
+ * ---
+ * What the hardware walk would give for va in pt: the kind and size of the
+ * mapping, the physical address va lands on, and the flags of the mapping in
+ * the mmu_query encoding. For fault handlers, COW and copying to/from user
+ * buffers, which translate the same few pages over and over.
+ *
+ * @return: The size of the mapping; 0 if va was not mapped
+ */
+unsigned mmu_translate(fld_t *pt, uint32_t va, mmu_xlate_t *x) {
+    struct xlate_ent *c = &xlate_cache[(va >> 12) % XLATE_ENTRIES];
+    if (c->gen == xlate_gen && c->pt == pt && (va & ~(c->x.size - 1)) == c->va) {
+        xlate_stats.n_hits++;
+        *x = c->x;
+        x->pa += va - c->va;
+        return x->size;
+    }
+
+    xlate_stats.n_misses++;
+    if (!xlate_walk(pt, va, x))
+        return 0;
+    c->pt = pt;
+    c->va = va & ~(x->size - 1);
+    c->gen = xlate_gen;
+    c->x = *x;
+    x->pa += va - c->va;
+    return x->size;
+}
+
+/*
+ * function: check the software walk against the hardware
+ * ---
+ * For every 4KB page of [va, va+len), compares the uncached software walk of
+ * pt with a privileged-read c7 translation (mmu_hw_translate), which walks the
+ * live tables: pt must be the table the hardware uses for the range, with the
+ * MMU on. Where the hardware refuses for domain or permission reasons the
+ * software walk only has to find a mapping. Prints each mismatch.
+ *
+ * @return: The number of pages that disagree
+ */
+unsigned mmu_xlate_verify(fld_t *pt, uint32_t va, uint32_t len) {
+    demand(is_aligned(va | len, SM_PAGE_SIZE), range must be 4KB aligned);
+
+    unsigned bad = 0;
+    for (uint32_t off = 0; off < len; off += SM_PAGE_SIZE) {
+        uint32_t v = va + off,
+                 par = mmu_hw_translate(v, HW_XLATE_PRIV, HW_XLATE_READ);
+        mmu_xlate_t x;
+        unsigned sz = xlate_walk(pt, v, &x), ok;
+        if (!HW_XLATE_ABORTED(par))
+            ok = sz && x.pa + (v & (sz - 1)) == hw_xlate_pa(par, v);
+        else {
+            unsigned st = HW_XLATE_STATUS(par);
+            ok = (st == 0b00101 || st == 0b00111) ? !sz : sz != 0;
+        }
+        if (!ok) {
+            printk("mmu_xlate_verify: va=%x: software pa=%x size=%d, PA register=%x\n",
+                v, sz ? x.pa + (v & (sz - 1)) : 0, sz, par);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/*
+ * function: read back an existing mapping
+ * ---
+ * Sets *pa to the physical address the mapping covering va starts at, and
+ * *flags to its AP/APX/nG/XN/S bits and memory type in the mmu_map_* flag
+ * encoding (AP always comes back with the F_NO_ACCESS "set" bit, the type as
+ * the MEM_* its TEX/C/B encode, MEM_UNKNOWN if none does). Goes through mmu_translate.
+ *
+ * @return: The size of the mapping; 0 if va was not mapped
+ */
+unsigned mmu_query(fld_t *pt, uint32_t va, uint32_t *pa, int *flags) {
+    mmu_xlate_t x;
+    if (!mmu_translate(pt, va, &x))
+        return 0;
+    *pa = x.pa & ~(x.size - 1);
+    *flags = x.flags;
+    return x.size;
+}
+
+/*
+ * function: move a range to another domain
+ * ---
+ * Rewrites the domain field of every section and coarse table descriptor in
+ * [va, va+len), which must be 1MB aligned: domains live in the first-level
+ * descriptors only, so the 256 pages of a coarse table share one (pg. B4-27).
+ * Supersections are always in domain 0 and are left alone, as are unmapped
+ * MBs. TLB entries hold the domain, so this ends with a full TLB flush: it is
+ * for setting regions up; switching their access is a DACR write.
+ *
+ * @return: The number of first-level descriptors changed
+ */
+unsigned mmu_set_domain(fld_t *pt, uint32_t va, uint32_t len, unsigned domain) {
+    demand(is_aligned(va | len, SECTION_SIZE), range must be 1MB aligned);
+    demand(domain < 16, no such domain);
+
+    unsigned n = 0;
+    for (uint32_t off = 0; off < len; off += SECTION_SIZE) {
+        fld_t *pde = mmu_first_level_lookup(pt, va + off);
+        if (pde->tag == FLD_FAULT_TAG
+        || (pde->tag == FLD_SECTION_TAG && ((sec_desc_t *)pde)->super))
+            continue;
+        if (pde->domain != domain) {
+            pde->domain = domain;
+            n++;
+        }
+    }
+    if (n) {
+        pt_clean(pt, get_first_level_table_idx(va), get_first_level_table_idx(va + len - 1));
+        mmu_sync_tlb();
+    }
+    return n;
+}
+
+/* Promoting pages */
+
+// Does [va, va+len) cover all of [s, s+size)?
+static int range_covers(uint32_t va, uint32_t len, uint32_t s, uint32_t size) {
+    return s >= va && len >= size && s - va <= len - size;
+}
+
+// The 16 entries at e are small pages mapping one 64KB-aligned block in order,
+// with the same attributes (so each is the first plus i * 4KB): make them a
+// large page.
+static int promote_lg_page(uint32_t *e) {
+    sm_page_desc_t *p = (sm_page_desc_t *)e;
+    if (p->tag != SLD_SM_PAGE_BIT_1 || p->APX || (e[0] & (LG_PAGE_SIZE - SM_PAGE_SIZE)))
+        return 0;
+    for (int i = 1; i < 16; i++)
+        if (e[i] != e[0] + i * SM_PAGE_SIZE)
+            return 0;
+
+    int flags = mk_flags(p->AP, p->APX, p->nG, p->XN, p->TEX, p->C, p->B, p->S);
+    if (FGET_MEM(flags) == MEM_UNKNOWN)
+        return 0;
+    mmu_desc_fill16(e, mmu_lg_page_desc(e[0], flags));
+    return 1;
+}
+
+// Same one level up: the coarse table pde points to holds 16 large pages
+// mapping one 1MB-aligned block in order. Rewrites pde as a section; the caller
+// frees the table once the TLB no longer holds its entries.
+static int promote_section(fld_t *pde) {
+    uint32_t *cpt = mmu_second_level_lookup(pde, 0);
+    lg_page_desc_t *p = (lg_page_desc_t *)cpt;
+    if (p->tag != SLD_LG_PAGE_TAG || p->APX || (cpt[0] & (SECTION_SIZE - LG_PAGE_SIZE)))
+        return 0;
+    for (int i = 1; i < 256; i++)
+        if (cpt[i] != cpt[0] + (i / 16) * LG_PAGE_SIZE)
+            return 0;
+
+    int flags = mk_flags(p->AP, p->APX, p->nG, p->XN, p->TEX, p->C, p->B, p->S);
+    if (FGET_MEM(flags) == MEM_UNKNOWN)
+        return 0;
+    desc_wr(pde, mmu_sec_desc(cpt[0], pde->domain, flags));
+    return 1;
+}
+
+/*
+ * function: promote filled-in pages to bigger ones
+ * ---
+ * Scans the coarse tables under [va, va+len). Every 64KB slot inside the range
+ * whose 16 small pages map one physically contiguous, 64KB-aligned block with
+ * identical attributes becomes a large page. A 1MB inside the range whose 16
+ * slots are then large pages mapping one contiguous, 1MB-aligned block the
+ * same way becomes a section in the coarse table's domain, and the table goes
+ * back to the pool. Demand paging maps 4KB and 64KB at a time; once a region
+ * fills in, this gets back the TLB reach of the bigger pages.
+ *
+ * Translations don't change, only page sizes, so the entries are rewritten in
+ * place and the old ones dropped with a full TLB flush: the range must not
+ * be touched until this returns. Write-protected (APX) mappings are left alone,
+ * since COW counts its sharers per mapping (cow.h), as are MEM_UNKNOWN ones.
+ *
+ * @return: The number of promotions (large pages plus sections) made
+ */
+unsigned mmu_promote(fld_t *pt, uint32_t va, uint32_t len) {
+    demand(is_aligned(va | len, SM_PAGE_SIZE), range must be 4KB aligned);
+    if (!len)
+        return 0;
+
+    unsigned n = 0, dirty = 0;
+    uint32_t last = get_first_level_table_idx(va + len - 1);
+    for (uint32_t i = get_first_level_table_idx(va); i <= last; i++) {
+        fld_t *pde = &pt[i];
+        if (pde->tag != FLD_COARSE_PT_TAG)
+            continue;
+
+        uint32_t *cpt = mmu_second_level_lookup(pde, 0);
+        for (uint32_t j = 0; j < 16; j++)
+            if (range_covers(va, len, i << 20 | j << 16, LG_PAGE_SIZE) && promote_lg_page(&cpt[j * 16])) {
+                n++;
+                dirty = 1;
+            }
+
+        if (range_covers(va, len, i << 20, SECTION_SIZE) && promote_section(pde)) {
+            n++;
+            // everything so far, since this clears dirty.
+            mmu_sync_range(pt, va, ((i + 1) << 20) - va);
+            dirty = 0;
+            pt_coarse_free(cpt);
+        }
+    }
+    if (dirty)
+        mmu_sync_range(pt, va, len);
+    if (n)
+        mmu_xlate_inval();
+    return n;
+}
+
 // Defined in .h file:
 // #define F_NO_ACCESS         0b100
 // #define F_NO_USR_ACCESS     0b101
 // #define F_NO_USR_WR_ACCESS  0b110
 // #define F_FULL_ACCESS       0b111
-// #define F_CACHEABLE         (0b1 << 3)
-// #define F_BUFFERABLE        (0b1 << 4)
 // #define F_SET_APX           (0b1 << 5)
 // #define F_NOT_GLOBAL        (0b1 << 6)
 // #define F_SHARED            (0b1 << 7)
 // #define F_EXEC_NEVER        (0b1 << 8)
+// #define F_MEM(type)         ((type) << 9)   // MEM_* memory type, bits 9-12
 
-// Defaults to full access if no flag was set via bit 3
-unsigned FGET_AP(int flags) { return flags & 0b100 ? flags & 0b11 : AP_FULL_ACCESS; }
-unsigned FGET_C(int flags) { return (flags & F_CACHEABLE) >> 3; }
-unsigned FGET_B(int flags) { return (flags & F_BUFFERABLE) >> 4; }
-unsigned FGET_APX(int flags) { return (flags & F_SET_APX) >> 5; }
-unsigned FGET_NG(int flags) { return (flags & F_NOT_GLOBAL) >> 6; }
-unsigned FGET_S(int flags) { return (flags & F_SHARED) >> 7; }
-unsigned FGET_XN(int flags) { return (flags & F_EXEC_NEVER) >> 8; }
+// FGET_* and the descriptor encoders are inline in mmu.h.
 
 // dwelch's code, for reference. uses more bit manipulation than our struct approach
 // #define MMUTABLEBASE 0x304000
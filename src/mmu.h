@@ -1,6 +1,8 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include "memmap-constants.h"   // PERIPHERAL_BASE: where RAM ends
+
 /*
     -----------------------------------------------------------------
     b4-26 first level descriptor  
@@ -13,7 +15,7 @@
     b4-27 section:
         31-20: section base address: must be aligned.
         19: sbz: "should be zero"
-        18: 0
+        18: 0 = section, 1 = 16MB supersection (repeated in 16 entries, domain 0)
         17: nG:  b4-25, global bit=0 implies global mapping, g=1, process 
                  specific.
         -16: S: 0 deprecated.
@@ -25,8 +27,8 @@
 
         -8-5: Domain: b4-10: 0b11 = manager (no perm check), 0b01 (checked perm)
         -4: XN: 1 = execute never,  0 = can execute.
-        3:C: set 0 see below
-        2:B: set 0
+        3:C: memory type, see below
+        2:B: memory type
         1: 1
         0: 0
 
@@ -48,7 +50,13 @@
 
     TEX   C  B 
     0b000 0  0 strongly ordered.   
+    0b000 0  1 shared device.
+    0b000 1  0 write-through, no write-allocate.
+    0b000 1  1 write-back, no write-allocate.
     0b001 0  0 non-cacheable
+    0b001 1  1 write-back, write-allocate.
+    0b010 0  0 non-shared device.
+    see MEM_* below.
 */
 
 // See pg. B4-9 on access permissions; these values are encoded into page table
@@ -66,11 +74,30 @@
 #define DOMAIN_RESERVED     0b10
 #define DOMAIN_MANAGER      0b11
 
-// See TEX on B4-12; encodes the memory region type. We start with strongly ordered,
-// always sharable
-#define TEX_DEFAULT         0b000
+// Memory region types: F_MEM(type) in the mapping flags picks the TEX/C/B bits
+// of the descriptor (pg. B4-12, table B4-3; TEX remap off). MEM_DEFAULT goes
+// by physical address: RAM is normal write-back write-allocate memory, the
+// peripheral window shared device memory.
+#define MEM_DEFAULT             0
+#define MEM_STRONGLY_ORDERED    1   // TEX=000 C=0 B=0
+#define MEM_DEVICE_SHARED       2   // TEX=000 C=0 B=1
+#define MEM_WT                  3   // TEX=000 C=1 B=0: write-through, no write-allocate
+#define MEM_WB                  4   // TEX=000 C=1 B=1: write-back, no write-allocate
+#define MEM_NORMAL_NC           5   // TEX=001 C=0 B=0: normal, non-cacheable
+#define MEM_WBWA                6   // TEX=001 C=1 B=1: write-back, write-allocate
+#define MEM_DEVICE              7   // TEX=010 C=0 B=0: non-shared device
+// Only ever read back (mmu_query, mmu_translate): a TEX/C/B none of the above
+// encodes, so the descriptor was not built by mmu_map_*. Mapping with it is an
+// error.
+#define MEM_UNKNOWN             8
 #define DOMAIN_DEFAULT      0
 
+// Bytes mapped by each kind of descriptor.
+#define SUPERSECTION_SIZE   (1 << 24)
+#define SECTION_SIZE        (1 << 20)
+#define LG_PAGE_SIZE        (1 << 16)
+#define SM_PAGE_SIZE        (1 << 12)
+
 #define FLD_FAULT_TAG       0b00
 #define FLD_COARSE_PT_TAG   0b01
 #define FLD_SECTION_TAG     0b10
@@ -79,8 +106,8 @@
 typedef struct section_descriptor {
     unsigned
         tag:2,      // 0-1:2    should be 0b10
-        B:1,        // 2:1      set to 0
-        C:1,        // 3:1      set to 0
+        B:1,        // 2:1      memory type with C and TEX, b4-12
+        C:1,        // 3:1
         XN:1,       // 4:1      1 = execute never, 0 = can execute
                     // needs to have XP=1 in ctrl-1.
 
@@ -210,18 +237,57 @@ typedef struct second_level_descriptor {
 #define fld_writeback_on(pte) (pte)->B = 1
 #define fld_writeback_off(pte) (pte)->B = 0
 
-// allocate page table and initialize.  handles alignment.
+// Page table memory is handed to the hardware by physical address. On the pi a
+// pointer and its physical address are the same; the host simulator (sim/)
+// overrides these to index into its simulated physical memory.
+#ifndef mmu_pa_to_ptr
+#define mmu_pa_to_ptr(pa) ((void *)(pa))
+#define mmu_ptr_to_pa(p) ((uint32_t)(p))
+#endif
+
+// a pointer the kernel can read mapped memory through, given its va and the pa
+// it maps to: the va itself on the pi (the current table maps it), the pa in
+// the simulator, which has no real MMU.
+#ifndef mmu_va_to_ptr
+#define mmu_va_to_ptr(va, pa) ((void *)(va))
+#endif
+
+// allocate page table and initialize.  handles alignment. n_entries is 4096 for
+// a full table, 4096 >> N for a TTBR0 table under TTBCR.N.
 fld_t *mmu_pt_alloc(unsigned n_entries);
+// free pt (of n_entries) and all of its coarse tables.
+void mmu_pt_free(fld_t *pt, unsigned n_entries);
+// clean pt (of n_entries) and its coarse tables out of the D-cache after
+// editing them in bulk; the caller does the TLB side.
+void mmu_pt_clean(fld_t *pt, unsigned n_entries);
 
 // map a 1mb section starting at va to pa
 fld_t *mmu_map_section(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags);
 
-// lookup section <va> in page table <pt>
+// map a 16MB supersection (always domain 0) starting at va to pa
+fld_t *mmu_map_supersection(fld_t *pt, uint32_t va, uint32_t pa, int flags);
+void mmu_unmap_supersection(fld_t *pt, uint32_t va);
+
+// lookup the first-level descriptor for <va> in page table <pt>; 0 if unmapped.
 fld_t *mmu_lookup(fld_t *pt, uint32_t va);
 
 // paranoid about flushing state w.r.t. PTE modifications.
 void mmu_sync_pte_mod(fld_t *f, fld_t e);
 
+// same flushing as mmu_sync_pte_mod, without the store: call once after a batch
+// of page table writes.
+void mmu_sync_pt(void);
+// its TLB half, for a batch whose descriptors were already cleaned.
+void mmu_sync_tlb(void);
+
+// after rewriting <nbytes> of descriptors at <pte>: clean just those lines and
+// invalidate the single TLB entry for <mva> (MVA | ASID).
+void mmu_sync_pte_mva(void *pte, unsigned nbytes, uint32_t mva);
+
+// after mmu_map_* (not _range) with the D-cache on: clean the descriptors
+// mapping <va> so the table walk, which doesn't look in the cache, sees them.
+void mmu_sync_map(fld_t *pt, uint32_t va);
+
 // print single PTE entry.
 void fld_print(fld_t *f);
 
@@ -251,28 +317,139 @@ static fld_t mk_coarse_page_table();
 sld_t *mmu_map_sm_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags);
 sld_t *mmu_map_lg_page(fld_t *pt, uint32_t va, uint32_t pa, int domain, int flags);
 
+// map [va, va+len) to [pa, pa+len) using the biggest pages that fit; returns the
+// number of descriptors used.
+unsigned mmu_map_range(fld_t *pt, uint32_t va, uint32_t pa, uint32_t len, int domain, int flags);
+
+// Changing existing mappings of any size. Each invalidates only the TLB entry
+// for <va>, and returns the size of the mapping changed (0 if not mapped).
+unsigned mmu_unmap(fld_t *pt, uint32_t va);
+unsigned mmu_remap(fld_t *pt, uint32_t va, uint32_t pa);
+unsigned mmu_protect(fld_t *pt, uint32_t va, int flags); // AP, APX, XN only
+
+// size, start pa and flags of the mapping covering <va>; 0 if not mapped.
+unsigned mmu_query(fld_t *pt, uint32_t va, uint32_t *pa, int *flags);
+
+// what mmu_translate found at a va.
+enum { MMU_KIND_FAULT = 0, MMU_KIND_SUPERSECTION, MMU_KIND_SECTION,
+       MMU_KIND_LG_PAGE, MMU_KIND_SM_PAGE };
+typedef struct {
+    uint32_t pa,        // of the va itself, not the start of the mapping
+             size;      // bytes the mapping covers
+    int flags;          // as mmu_query
+    unsigned kind;      // MMU_KIND_*
+} mmu_xlate_t;
+
+// software va->pa for <va> in <pt>: fills *x and returns the mapping size, 0
+// (and kind MMU_KIND_FAULT) if not mapped. Goes through a small translation
+// cache the mmu_* calls keep coherent; code that rewrites or clears existing
+// descriptors itself must call mmu_xlate_inval.
+unsigned mmu_translate(fld_t *pt, uint32_t va, mmu_xlate_t *x);
+void mmu_xlate_inval(void);
+
+// compare the software walk of <pt> with the hardware one (mmu_hw_translate)
+// for each page of [va, va+len); pt must be live. returns the mismatches.
+unsigned mmu_xlate_verify(fld_t *pt, uint32_t va, uint32_t len);
+
+typedef struct {
+    unsigned n_hits,
+             n_misses,
+             n_invals;
+} mmu_xlate_stats_t;
+mmu_xlate_stats_t mmu_xlate_stats(void);
+
+// put the sections and coarse tables of [va, va+len) (1MB aligned) in
+// <domain>; returns how many descriptors changed. flushes the whole TLB.
+unsigned mmu_set_domain(fld_t *pt, uint32_t va, uint32_t len, unsigned domain);
+
+// rewrite runs of small pages as large pages and full coarse tables as sections
+// where the frames are contiguous and the flags match; returns the number of
+// promotions. [va, va+len) must not be accessed meanwhile.
+unsigned mmu_promote(fld_t *pt, uint32_t va, uint32_t len);
+
 // Extracting flags
 #define F_NO_ACCESS         0b100
 #define F_NO_USR_ACCESS     0b101
 #define F_NO_USR_WR_ACCESS  0b110
 #define F_FULL_ACCESS       0b111
-#define F_CACHEABLE         (0b1 << 3)
-#define F_BUFFERABLE        (0b1 << 4)
 #define F_SET_APX           (0b1 << 5)
 #define F_NOT_GLOBAL        (0b1 << 6)
 #define F_SHARED            (0b1 << 7)
 #define F_EXEC_NEVER        (0b1 << 8)
+#define F_MEM(type)         ((type) << 9)   // MEM_* memory type, bits 9-12
+
+// Inline so that constant flags fold away. AP defaults to full access unless
+// bit 2 (0b100, the "AP set" bit of the F_*_ACCESS flags) is set.
+static inline unsigned FGET_AP(int flags) { return flags & 0b100 ? flags & 0b11 : AP_FULL_ACCESS; }
+static inline unsigned FGET_APX(int flags) { return (flags & F_SET_APX) >> 5; }
+static inline unsigned FGET_NG(int flags) { return (flags & F_NOT_GLOBAL) >> 6; }
+static inline unsigned FGET_S(int flags) { return (flags & F_SHARED) >> 7; }
+static inline unsigned FGET_XN(int flags) { return (flags & F_EXEC_NEVER) >> 8; }
+static inline unsigned FGET_MEM(int flags) { return (flags >> 9) & 0xF; }
+
+// TEX << 2 | C << 1 | B for each MEM_* type, a nibble apiece (TEX <= 0b010),
+// so the lookup is a shift rather than a branch.
+#define MEM_ATTR_TABLE  (0b1000u << 4 * MEM_DEVICE    \
+                       | 0b0111u << 4 * MEM_WBWA      \
+                       | 0b0100u << 4 * MEM_NORMAL_NC \
+                       | 0b0011u << 4 * MEM_WB        \
+                       | 0b0010u << 4 * MEM_WT        \
+                       | 0b0001u << 4 * MEM_DEVICE_SHARED)
+
+// TEX << 2 | C << 1 | B for the memory type in <flags>, mapping <pa>.
+static inline unsigned mmu_mem_attr(int flags, uint32_t pa) {
+    unsigned t = FGET_MEM(flags);
+    if (t == MEM_DEFAULT)
+        t = pa < PERIPHERAL_BASE ? MEM_WBWA : MEM_DEVICE_SHARED;
+    return (MEM_ATTR_TABLE >> (4 * t)) & 0xF;
+}
+#define MEM_TEX(m)  ((m) >> 2)
+#define MEM_C(m)    (((m) >> 1) & 1)
+#define MEM_B(m)    ((m) & 1)
 
-unsigned FGET_AP(int flags);
-unsigned FGET_C(int flags);
-unsigned FGET_B(int flags);
-unsigned FGET_APX(int flags);
-unsigned FGET_NG(int flags);
-unsigned FGET_S(int flags);
-unsigned FGET_XN(int flags);
-
-// Handling page misses (see driver.c for the code, we need access to the current page table)
-void handle_page_miss(unsigned address);
+/*
+ * Descriptor encoders
+ * ---
+ * The whole 32-bit descriptor mapping <pa> with <flags>: the same bits filling
+ * in the sec_desc_t / lg_page_desc_t / sm_page_desc_t fields one by one gives
+ * (pg. B4-27, B4-31), as a single expression. With constant flags the
+ * attribute part folds to a constant (plus the RAM/device choice for
+ * MEM_DEFAULT), leaving an and and an or of pa. pa must be aligned to the page
+ * size.
+ */
+static inline uint32_t mmu_sec_desc(uint32_t pa, unsigned domain, int flags) {
+    unsigned m = mmu_mem_attr(flags, pa);
+    return (pa & ~(SECTION_SIZE - 1))
+        | FGET_NG(flags) << 17 | FGET_S(flags) << 16 | FGET_APX(flags) << 15
+        | MEM_TEX(m) << 12 | FGET_AP(flags) << 10 | (domain & 0xF) << 5
+        | FGET_XN(flags) << 4 | MEM_C(m) << 3 | MEM_B(m) << 2
+        | FLD_SECTION_TAG;
+}
+
+// supersection: bit 18 set, domain field always 0 (pg. B4-27).
+static inline uint32_t mmu_supersec_desc(uint32_t pa, int flags) {
+    return mmu_sec_desc(pa & ~(SUPERSECTION_SIZE - 1), 0, flags) | 1 << 18;
+}
+
+static inline uint32_t mmu_lg_page_desc(uint32_t pa, int flags) {
+    unsigned m = mmu_mem_attr(flags, pa);
+    return (pa & ~(LG_PAGE_SIZE - 1))
+        | FGET_XN(flags) << 15 | MEM_TEX(m) << 12 | FGET_NG(flags) << 11
+        | FGET_S(flags) << 10 | FGET_APX(flags) << 9 | FGET_AP(flags) << 4
+        | MEM_C(m) << 3 | MEM_B(m) << 2 | SLD_LG_PAGE_TAG;
+}
+
+static inline uint32_t mmu_sm_page_desc(uint32_t pa, int flags) {
+    unsigned m = mmu_mem_attr(flags, pa);
+    return (pa & ~(SM_PAGE_SIZE - 1))
+        | FGET_NG(flags) << 11 | FGET_S(flags) << 10 | FGET_APX(flags) << 9
+        | MEM_TEX(m) << 6 | FGET_AP(flags) << 4 | MEM_C(m) << 3
+        | MEM_B(m) << 2 | SLD_SM_PAGE_BIT_1 << 1 | FGET_XN(flags);
+}
+
+// store <d> into the 16 consecutive entries at <p> (vm-asm.S: four stm bursts).
+// used for the replicas of large pages and supersections.
+void mmu_desc_fill16(void *p, uint32_t d);
 
 #if 0
 // same as disable/enable except client gives the control reg to use --- 
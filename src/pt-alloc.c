@@ -0,0 +1,114 @@
+/*
+ * File: coarse page table pool
+ * ---
+ * Free tables are linked through their own first word; a table is zeroed when
+ * it is handed out, so the link never shows up as a descriptor.
+ */
+#include "rpi.h"
+#include "mmu.h"
+#include "pt-alloc.h"
+
+typedef struct free_table {
+    struct free_table *next;
+} free_table_t;
+
+// first-level free lists are indexed by N: tables of PT_L1_SIZE >> N.
+static free_table_t *free_list, *l1_free_list[8];
+static pt_stats_t stats;
+
+#define TABLES_PER_CHUNK (PT_CHUNK_SIZE / PT_COARSE_SIZE)
+
+static unsigned l1_slot(unsigned size) {
+    demand(size >= PT_L1_MIN_SIZE && size <= PT_L1_SIZE && !(size & (size - 1)),
+        not a first-level table size);
+    return __builtin_ctz(PT_L1_SIZE / size);
+}
+
+// one more chunk onto the free list.
+static void pt_grow(void) {
+    char *c = kmalloc_aligned(PT_CHUNK_SIZE, PT_CHUNK_SIZE);
+    stats.n_chunks++;
+
+    // push in reverse so tables come out in address order.
+    for(int i = TABLES_PER_CHUNK - 1; i >= 0; i--) {
+        free_table_t *t = (void *)(c + i * PT_COARSE_SIZE);
+        t->next = free_list;
+        free_list = t;
+        stats.n_free++;
+    }
+}
+
+void *pt_coarse_alloc(void) {
+    if(!free_list)
+        pt_grow();
+
+    free_table_t *t = free_list;
+    free_list = t->next;
+    memset(t, 0, PT_COARSE_SIZE);
+
+    stats.n_free--;
+    stats.n_allocs++;
+    if(++stats.n_used > stats.n_peak)
+        stats.n_peak = stats.n_used;
+    return t;
+}
+
+void pt_coarse_free(void *p) {
+    demand((mmu_ptr_to_pa(p) & (PT_COARSE_SIZE - 1)) == 0, not a coarse table);
+    demand(stats.n_used > 0, freeing more tables than allocated);
+
+    free_table_t *t = p;
+    t->next = free_list;
+    free_list = t;
+
+    stats.n_used--;
+    stats.n_free++;
+    stats.n_frees++;
+}
+
+void *pt_l1_alloc(unsigned size) {
+    free_table_t **l = &l1_free_list[l1_slot(size)], *t = *l;
+    if(t) {
+        *l = t->next;
+        stats.n_l1_free--;
+        memset(t, 0, size);
+    } else
+        t = kmalloc_aligned(size, size);
+
+    stats.n_l1_bytes += size;
+    if(++stats.n_l1_used > stats.n_l1_peak)
+        stats.n_l1_peak = stats.n_l1_used;
+    return t;
+}
+
+void pt_l1_free(void *p, unsigned size) {
+    free_table_t **l = &l1_free_list[l1_slot(size)];
+    demand((mmu_ptr_to_pa(p) & (size - 1)) == 0, not a first-level table);
+    demand(stats.n_l1_used > 0, freeing more tables than allocated);
+
+    free_table_t *t = p;
+    t->next = *l;
+    *l = t;
+
+    stats.n_l1_bytes -= size;
+    stats.n_l1_used--;
+    stats.n_l1_free++;
+}
+
+pt_stats_t pt_stats(void) {
+    return stats;
+}
+
+void pt_stats_print(const char *msg) {
+    printk("%s: %d coarse tables in use (peak %d), %d free, %d bytes in %d chunks\n",
+        msg, stats.n_used, stats.n_peak, stats.n_free,
+        stats.n_chunks * PT_CHUNK_SIZE, stats.n_chunks);
+    printk("%s: %d first-level tables in use (%d bytes, peak %d), %d free\n",
+        msg, stats.n_l1_used, stats.n_l1_bytes, stats.n_l1_peak, stats.n_l1_free);
+}
+
+void pt_alloc_reset(void) {
+    free_list = 0;
+    memset(l1_free_list, 0, sizeof l1_free_list);
+    memset(&stats, 0, sizeof stats);
+}
@@ -0,0 +1,56 @@
+#ifndef __PT_ALLOC_H__
+#define __PT_ALLOC_H__
+
+/*
+ * Page table pools
+ * ---
+ * Coarse tables are 1KB and must be 1KB aligned (pg. B4-30). Getting each one
+ * from kmalloc_aligned wastes the alignment padding for good, since the heap
+ * never gives memory back. Instead we carve tables out of 4KB-aligned chunks
+ * (four tables each) and keep freed tables on a free list, so page-table
+ * memory tracks the peak number of tables in use, and tables emptied by
+ * unmaps or env teardown get reused.
+ *
+ * First-level tables get the same treatment with a free list per size, so env
+ * teardown can hand them back too. A full table is 16KB, 16KB-aligned (pg.
+ * B4-26); a TTBR0 table under TTBCR.N covers only the bottom 4GB >> N and is
+ * 16KB >> N, aligned to its size (pg. B4-41).
+ */
+#include <stdint.h>
+
+#define PT_COARSE_SIZE  1024
+#define PT_CHUNK_SIZE   4096
+#define PT_L1_SIZE      (4096 * 4)
+#define PT_L1_MIN_SIZE  (PT_L1_SIZE >> 7)   // TTBCR.N = 7
+
+// returns a zero-filled 1KB-aligned coarse table.
+void *pt_coarse_alloc(void);
+void pt_coarse_free(void *t);
+
+// returns a zero-filled first-level table of <size> bytes (a power of two from
+// PT_L1_MIN_SIZE to PT_L1_SIZE), aligned to its size.
+void *pt_l1_alloc(unsigned size);
+void pt_l1_free(void *t, unsigned size);
+
+typedef struct {
+    unsigned n_chunks,  // chunks taken from kmalloc
+             n_used,    // tables handed out right now
+             n_free,    // tables on the free list
+             n_peak,    // high-water mark of n_used
+             n_allocs,
+             n_frees;
+
+    // first-level tables
+    unsigned n_l1_used,
+             n_l1_free,
+             n_l1_peak,
+             n_l1_bytes;    // bytes of tables handed out right now
+} pt_stats_t;
+
+pt_stats_t pt_stats(void);
+void pt_stats_print(const char *msg);
+
+// forget every chunk: only for use after kfree_all() (e.g., the simulator).
+void pt_alloc_reset(void);
+
+#endif
@@ -0,0 +1,1778 @@
+/*
+ * mmu-bench: page-table builder throughput on the host
+ * ---
+ * Runs mmu.c against simulated physical memory: maps millions of sections,
+ * large and small pages into fresh tables, then does random lookups through
+ * the software walk. Every mapping built is walked back and checked, so a
+ * broken descriptor fails the run (non-zero exit) instead of just being fast.
+ *
+ * usage: mmu-bench [n_ops]
+ */
+#include <time.h>
+
+#include "rpi.h"
+#include "mmu.h"
+#include "cp15-arm.h"
+#include "env.h"
+#include "pt-alloc.h"
+#include "cow.h"
+#include "vma.h"
+#include "tlb-lock.h"
+#include "frame.h"
+#include "fault-stats.h"
+#include "dirty.h"
+#include "age.h"
+#include "swap.h"
+#include "lz.h"
+#include "cache.h"
+#include "memmap-constants.h"
+#include "sim-cp15.h"
+#include "sim-walk.h"
+
+#define MB (1u << 20)
+#define KB (1u << 10)
+
+// same shape as a pi: page tables come out of a heap just above the kernel,
+// frames (frame.c) out of [FRAME_START, RAM_SIZE), set in the Makefile.
+#define SIM_RAM_SIZE    RAM_SIZE
+#define SIM_HEAP_START  0x140000
+
+#define BENCH_DOMAIN    1
+
+// somewhere inside simulated RAM to stand in for a device window.
+#define PERIPHERAL_BASE_SIM (60 * MB)
+
+static unsigned n_errors;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// cheap deterministic random numbers for the lookup mix.
+static uint32_t xorshift(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static fld_t *fresh_pt(void) {
+    kfree_all();
+    pt_alloc_reset();
+    return mmu_pt_alloc(4096);
+}
+
+// make <pt> the table the walk uses, with the bench domain and domain 0 (for
+// supersections) as clients.
+static void use_pt(fld_t *pt) {
+    cp15_ttbr_ctrl_wr(0);
+    cp15_set_procid_ttbr0(1 << 8 | 1, pt);
+    cp15_domain_ctrl_wr(DOMAIN_CLIENT << (BENCH_DOMAIN * 2) | DOMAIN_CLIENT);
+}
+
+// walk <va> and check it lands on <pa> with a mapping of <size> bytes.
+static void expect(uint32_t va, uint32_t pa, unsigned size) {
+    sim_xlate_t x;
+    if(sim_translate(va, SIM_ACC_WRITE, &x) != SIM_OK) {
+        printk("ERROR: va=0x%x: fault status 0b%u\n", va, x.status);
+        n_errors++;
+    } else if(x.pa != pa || x.size != size) {
+        printk("ERROR: va=0x%x: expected pa=0x%x size=%u, got pa=0x%x size=%u\n",
+            va, pa, size, x.pa, x.size);
+        n_errors++;
+    }
+}
+
+static void expect_fault(uint32_t va) {
+    sim_xlate_t x;
+    if(sim_translate(va, SIM_ACC_READ, &x) == SIM_OK) {
+        printk("ERROR: va=0x%x: expected fault, mapped to pa=0x%x\n", va, x.pa);
+        n_errors++;
+    }
+}
+
+static void report(const char *name, unsigned n, double ns) {
+    printk("%-16s %10u ops %10.1f ms %8.1f ns/op\n", name, n, ns / 1e6, ns / n);
+}
+
+// the mmu_*_desc encoders must give exactly the bits the descriptor structs
+// describe: read every field back through the struct for every flag value.
+#define FIELDS_OK(d, pa_field, pa_shift, pa) \
+    ((d).pa_field == (pa) >> (pa_shift) && (d).AP == FGET_AP(flags) \
+    && (d).APX == FGET_APX(flags) && (d).nG == FGET_NG(flags) \
+    && (d).S == FGET_S(flags) && (d).XN == FGET_XN(flags) \
+    && (d).TEX == MEM_TEX(mmu_mem_attr(flags, pa)) \
+    && (d).C == MEM_C(mmu_mem_attr(flags, pa)) && (d).B == MEM_B(mmu_mem_attr(flags, pa)))
+
+static void check_encoders(void) {
+    unsigned bad = 0;
+    for(int flags = 0; flags < F_MEM(MEM_DEVICE + 1); flags++) {
+        union { uint32_t u; sec_desc_t sec; lg_page_desc_t lg; sm_page_desc_t sm; } d;
+
+        for(unsigned dom = 0; dom < 16; dom++) {
+            d.u = mmu_sec_desc(0xabc00000, dom, flags);
+            if(!FIELDS_OK(d.sec, sec_base_addr, 20, 0xabc00000)
+            || d.sec.tag != FLD_SECTION_TAG || d.sec.domain != dom || d.sec.super)
+                bad++;
+        }
+        d.u = mmu_supersec_desc(0xab000000, flags);
+        if(!FIELDS_OK(d.sec, sec_base_addr, 20, 0xab000000)
+        || d.sec.tag != FLD_SECTION_TAG || d.sec.domain || !d.sec.super)
+            bad++;
+
+        d.u = mmu_lg_page_desc(0xabcd0000, flags);
+        if(!FIELDS_OK(d.lg, base, 16, 0xabcd0000) || d.lg.tag != SLD_LG_PAGE_TAG)
+            bad++;
+
+        d.u = mmu_sm_page_desc(0xabcde000, flags);
+        if(!FIELDS_OK(d.sm, base, 12, 0xabcde000) || d.sm.tag != SLD_SM_PAGE_BIT_1)
+            bad++;
+    }
+
+    // memory types: MEM_DEFAULT picks by pa, and mmu_query hands back the
+    // explicit type for every page size.
+    fld_t *pt = fresh_pt();
+    uint32_t pa;
+    int f;
+    mmu_map_section(pt, 0, 0, BENCH_DOMAIN, 0);
+    mmu_map_section(pt, PERIPHERAL_BASE, PERIPHERAL_BASE, BENCH_DOMAIN, 0);
+    if(!mmu_query(pt, 0, &pa, &f) || FGET_MEM(f) != MEM_WBWA
+    || !mmu_query(pt, PERIPHERAL_BASE, &pa, &f) || FGET_MEM(f) != MEM_DEVICE_SHARED)
+        bad++;
+    for(unsigned t = MEM_STRONGLY_ORDERED; t <= MEM_DEVICE; t++) {
+        uint32_t va = 16 * MB + t * MB;
+        mmu_map_section(pt, va, va, BENCH_DOMAIN, F_MEM(t));
+        mmu_map_lg_page(pt, va + 64 * MB, va, BENCH_DOMAIN, F_MEM(t));
+        mmu_map_sm_page(pt, va + 128 * MB, va, BENCH_DOMAIN, F_MEM(t));
+        for(unsigned k = 0; k < 3; k++)
+            if(!mmu_query(pt, va + k * 64 * MB, &pa, &f) || FGET_MEM(f) != t)
+                bad++;
+    }
+
+    if(bad) {
+        printk("ERROR: %u descriptor encodings disagree with the structs\n", bad);
+        n_errors += bad;
+    }
+}
+
+/* benchmarks: each builds tables in rounds until it has done <n> operations. */
+
+// all 4096 sections of the address space per round.
+static void bench_map_section(unsigned n) {
+    unsigned ops = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        double s = now_ns();
+        for(unsigned i = 0; i < 4096; i++)
+            mmu_map_section(pt, i * MB, (4095 - i) * MB, BENCH_DOMAIN, 0);
+        t += now_ns() - s;
+        ops += 4096;
+    }
+    report("map_section", ops, t);
+
+    use_pt(pt);
+    for(unsigned i = 0; i < 4096; i++)
+        expect(i * MB + 0x12345, (4095 - i) * MB + 0x12345, MB);
+}
+
+// all 256 supersections of the address space per round.
+static void bench_map_supersection(unsigned n) {
+    unsigned ops = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        double s = now_ns();
+        for(unsigned i = 0; i < 256; i++)
+            mmu_map_supersection(pt, i * 16 * MB, (255 - i) * 16 * MB, 0);
+        t += now_ns() - s;
+        ops += 256;
+    }
+    report("map_supersect", ops, t);
+
+    use_pt(pt);
+    for(unsigned i = 0; i < 4096; i++)
+        expect(i * MB + 0x12345, (255 - i / 16) * 16 * MB + (i % 16) * MB + 0x12345, 16 * MB);
+
+    mmu_unmap_supersection(pt, 0x20345678);
+    for(unsigned i = 0; i < 16; i++)
+        expect_fault(0x20000000 + i * MB);
+    expect(0x1fffffff, (255 - 0x1f) * 16 * MB + 0xffffff, 16 * MB);
+    expect(0x21000000, (255 - 0x21) * 16 * MB, 16 * MB);
+}
+
+// 16MB of small pages (16 coarse tables) per round.
+#define SM_BASE (16 * MB)
+#define SM_N    4096
+static void bench_map_sm_page(unsigned n) {
+    unsigned ops = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        double s = now_ns();
+        for(unsigned i = 0; i < SM_N; i++)
+            mmu_map_sm_page(pt, SM_BASE + i * 4 * KB,
+                SM_BASE + i * 4 * KB, BENCH_DOMAIN, 0);
+        t += now_ns() - s;
+        ops += SM_N;
+    }
+    report("map_sm_page", ops, t);
+
+    use_pt(pt);
+    for(unsigned i = 0; i < SM_N; i++)
+        expect(SM_BASE + i * 4 * KB + 0xabc, SM_BASE + i * 4 * KB + 0xabc, 4 * KB);
+    expect_fault(SM_BASE - 4 * KB);
+    expect_fault(SM_BASE + SM_N * 4 * KB);
+}
+
+// 64MB of large pages per round, all 16 slots of every coarse table.
+#define LG_BASE (64 * MB)
+#define LG_N    1024
+
+static void bench_map_lg_page(unsigned n) {
+    unsigned ops = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        double s = now_ns();
+        for(unsigned i = 0; i < LG_N; i++)
+            mmu_map_lg_page(pt, LG_BASE + i * 64 * KB,
+                LG_BASE + i * 64 * KB, BENCH_DOMAIN, 0);
+        t += now_ns() - s;
+        ops += LG_N;
+    }
+    report("map_lg_page", ops, t);
+
+    use_pt(pt);
+    for(unsigned i = 0; i < LG_N; i++) {
+        uint32_t va = LG_BASE + i * 64 * KB;
+        expect(va + 0xfedc, va + 0xfedc, 64 * KB);
+        // the last 4KB of the last slot, where the replicas end at cpt[255].
+        if(i % 16 == 15)
+            expect(va + 0xfffc, va + 0xfffc, 64 * KB);
+    }
+    expect_fault(LG_BASE + LG_N * 64 * KB);
+    pt_stats_t st = pt_stats();
+    if(st.n_used != LG_N / 16) {
+        printk("ERROR: %u large pages used %u coarse tables, expected %u\n",
+            LG_N, st.n_used, LG_N / 16);
+        n_errors++;
+    }
+}
+
+// redo the greedy choice the range mapper should have made and check every 4KB
+// of each descriptor it picked, plus the pages on either side.
+static void check_range(uint32_t va, uint32_t pa, uint32_t len, int domain) {
+    expect_fault(va - 4 * KB);
+    expect_fault(va + len);
+
+    while(len) {
+        unsigned sz = 4 * KB;
+        if(domain == 0 && (va | pa) % (16 * MB) == 0 && len >= 16 * MB)
+            sz = 16 * MB;
+        else if((va | pa) % MB == 0 && len >= MB)
+            sz = MB;
+        else if((va | pa) % (64 * KB) == 0 && len >= 64 * KB)
+            sz = 64 * KB;
+        for(uint32_t off = 0; off < sz; off += 4 * KB)
+            expect(va + off + 0x10, pa + off + 0x10, sz);
+        va += sz;
+        pa += sz;
+        len -= sz;
+    }
+}
+
+// one unaligned 64MB range per round.  ops are counted in 4KB pages covered, so
+// ns/op compares directly against map_sm_page.
+#define RANGE_VA    (0x10000000 + 0x3000)
+#define RANGE_PA    (0x00800000 + 0x3000)
+#define RANGE_LEN   (64 * MB + 0x5000)
+static void bench_map_range(unsigned n) {
+    unsigned ops = 0, ndesc = 0, nsync = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        nsync = sim_cp15.n_sync;
+        double s = now_ns();
+        ndesc = mmu_map_range(pt, RANGE_VA, RANGE_PA, RANGE_LEN, BENCH_DOMAIN, 0);
+        t += now_ns() - s;
+        nsync = sim_cp15.n_sync - nsync;
+        ops += RANGE_LEN / (4 * KB);
+    }
+    report("map_range", ops, t);
+    printk("%-16s %10u descriptors per range (vs %u small pages), %u syncs\n", "",
+        ndesc, RANGE_LEN / (4 * KB), nsync);
+
+    use_pt(pt);
+    check_range(RANGE_VA, RANGE_PA, RANGE_LEN, BENCH_DOMAIN);
+
+    // in domain 0 the range mapper can also use supersections: something
+    // shaped like the peripheral window, with ragged edges.
+    pt = fresh_pt();
+    ndesc = mmu_map_range(pt, 0x1f000000 + 0x3000, 0x1f000000 + 0x3000,
+        0x3000000 - 0x3000, 0, 0);
+    printk("%-16s %10u descriptors for a 48MB domain 0 range\n", "", ndesc);
+    use_pt(pt);
+    check_range(0x1f000000 + 0x3000, 0x1f000000 + 0x3000, 0x3000000 - 0x3000, 0);
+}
+
+// flip small pages between read-only and read-write, the mprotect pattern.
+// checks that none of it falls back to a whole-TLB flush.
+static void bench_protect(unsigned n) {
+    fld_t *pt = fresh_pt();
+    mmu_map_range(pt, SM_BASE, SM_BASE, SM_N * 4 * KB, BENCH_DOMAIN, 0);
+    for(unsigned i = 0; i < SM_N; i++)
+        mmu_unmap(pt, SM_BASE + i * 4 * KB);
+    for(unsigned i = 0; i < SM_N; i++)
+        mmu_map_sm_page(pt, SM_BASE + i * 4 * KB, SM_BASE + i * 4 * KB, BENCH_DOMAIN, 0);
+    use_pt(pt);
+
+    unsigned ntlb = sim_cp15.n_tlb_inv;
+    uint32_t seed = 0x2545f491;
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i++) {
+        uint32_t va = SM_BASE + (xorshift(&seed) % SM_N) * 4 * KB;
+        mmu_protect(pt, va, (i & 1) ? F_NO_USR_WR_ACCESS : F_FULL_ACCESS);
+    }
+    report("protect", n, now_ns() - s);
+    if(sim_cp15.n_tlb_inv != ntlb) {
+        printk("ERROR: protect flushed the whole TLB %u times\n", sim_cp15.n_tlb_inv - ntlb);
+        n_errors++;
+    }
+
+    // permissions, remap and unmap as the walk sees them.
+    sim_xlate_t x;
+    mmu_protect(pt, SM_BASE, F_NO_USR_WR_ACCESS);
+    if(sim_translate(SM_BASE, SIM_ACC_WRITE | SIM_ACC_USER, &x) != SIM_FAULT_PAGE_PERM
+    || sim_translate(SM_BASE, SIM_ACC_READ | SIM_ACC_USER, &x) != SIM_OK) {
+        printk("ERROR: protect did not make va=0x%x read-only\n", SM_BASE);
+        n_errors++;
+    }
+    mmu_protect(pt, SM_BASE, F_FULL_ACCESS);
+    expect(SM_BASE, SM_BASE, 4 * KB);
+
+    mmu_remap(pt, SM_BASE + 4 * KB, 0x123000);
+    expect(SM_BASE + 4 * KB + 0x45, 0x123045, 4 * KB);
+    mmu_unmap(pt, SM_BASE + 8 * KB + 0x10);
+    expect_fault(SM_BASE + 8 * KB);
+    expect(SM_BASE + 12 * KB, SM_BASE + 12 * KB, 4 * KB);
+}
+
+// map a scattered small page in each of PT_CHURN_MB sections, then unmap them
+// all, over and over: every round allocates and frees PT_CHURN_MB coarse
+// tables. the pool must hand the same memory back instead of growing.
+#define PT_CHURN_MB 64
+static void bench_pt_churn(unsigned n) {
+    fld_t *pt = fresh_pt();
+    use_pt(pt);
+
+    uint32_t va[PT_CHURN_MB], seed = 0x6b43a9b5;
+    unsigned ops = 0;
+    double s = now_ns();
+    while(ops < n) {
+        for(unsigned i = 0; i < PT_CHURN_MB; i++) {
+            va[i] = (128 + i) * MB + (xorshift(&seed) % 256) * 4 * KB;
+            mmu_map_sm_page(pt, va[i], va[i], BENCH_DOMAIN, 0);
+        }
+        for(unsigned i = 0; i < PT_CHURN_MB; i++)
+            mmu_unmap(pt, va[i]);
+        ops += 2 * PT_CHURN_MB;
+    }
+    report("pt_churn", ops, now_ns() - s);
+
+    pt_stats_t st = pt_stats();
+    printk("%-16s %10u chunks (%u bytes) for %u table allocations\n", "",
+        st.n_chunks, st.n_chunks * PT_CHUNK_SIZE, st.n_allocs);
+    if(st.n_used || st.n_peak != PT_CHURN_MB
+    || st.n_chunks != PT_CHURN_MB * PT_COARSE_SIZE / PT_CHUNK_SIZE) {
+        printk("ERROR: coarse tables not reused: %u in use, peak %u, %u chunks\n",
+            st.n_used, st.n_peak, st.n_chunks);
+        n_errors++;
+    }
+    for(unsigned i = 0; i < PT_CHURN_MB; i++)
+        if(mmu_lookup(pt, (128 + i) * MB)) {
+            printk("ERROR: empty coarse table left hooked at 0x%x\n", (128 + i) * MB);
+            n_errors++;
+        }
+}
+
+// identity map all three page sizes: 16 sections at 0, SM_N small pages at
+// SM_BASE and LG_N large pages at LG_BASE.
+static fld_t *mixed_pt(void) {
+    fld_t *pt = fresh_pt();
+
+    for(unsigned i = 0; i < 16; i++)
+        mmu_map_section(pt, i * MB, i * MB, BENCH_DOMAIN, 0);
+    for(unsigned i = 0; i < SM_N; i++)
+        mmu_map_sm_page(pt, SM_BASE + i * 4 * KB, SM_BASE + i * 4 * KB, BENCH_DOMAIN, 0);
+    for(unsigned i = 0; i < LG_N; i++)
+        mmu_map_lg_page(pt, LG_BASE + i * 64 * KB, LG_BASE + i * 64 * KB, BENCH_DOMAIN, 0);
+    return pt;
+}
+
+// a random va from one of the three parts of mixed_pt.
+static uint32_t mixed_va(unsigned i, uint32_t *seed) {
+    switch(i % 3) {
+    case 0:     return xorshift(seed) % (16 * MB);
+    case 1:     return SM_BASE + xorshift(seed) % (SM_N * 4 * KB);
+    default:    return LG_BASE + xorshift(seed) % (LG_N * 64 * KB);
+    }
+}
+
+// random lookups over a table mixing all three page sizes.
+static void bench_lookup(unsigned n) {
+    fld_t *pt = mixed_pt();
+    use_pt(pt);
+
+    uint32_t seed = 0x9e3779b9;
+    unsigned bad = 0;
+    sim_xlate_t x;
+
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i++) {
+        uint32_t va = mixed_va(i, &seed);
+        if(sim_translate(va, SIM_ACC_READ, &x) != SIM_OK || x.pa != va)
+            bad++;
+    }
+    report("lookup", n, now_ns() - s);
+
+    if(bad) {
+        printk("ERROR: %u lookups translated wrong\n", bad);
+        n_errors += bad;
+    }
+}
+
+// mmu_translate: random vas over mixed_pt, which mostly miss the cache, then
+// the copy-in pattern of a few pages read a word at a time, which should hit.
+// every answer is checked against the hardware walk, also right after each
+// kind of table change.
+#define XLATE_HOT_PAGES 4
+static int xlate_ok(fld_t *pt, uint32_t va) {
+    mmu_xlate_t x;
+    sim_xlate_t w;
+    unsigned sz = mmu_translate(pt, va, &x);
+    if(sim_translate(va, SIM_ACC_READ, &w) != SIM_OK)
+        return !sz && x.kind == MMU_KIND_FAULT;
+    static const unsigned kind[] = {
+        [MMU_KIND_SUPERSECTION] = 16 * MB, [MMU_KIND_SECTION] = MB,
+        [MMU_KIND_LG_PAGE] = 64 * KB, [MMU_KIND_SM_PAGE] = 4 * KB,
+    };
+    return sz == w.size && x.pa == w.pa && x.kind && kind[x.kind] == sz;
+}
+
+static void bench_translate(unsigned n) {
+    fld_t *pt = mixed_pt();
+    use_pt(pt);
+
+    uint32_t seed = 0x7f4a7c15;
+    unsigned bad = 0;
+    mmu_xlate_t x;
+    mmu_xlate_stats_t st = mmu_xlate_stats();
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i++) {
+        uint32_t va = mixed_va(i, &seed);
+        if(mmu_translate(pt, va, &x) != x.size || x.pa != va)
+            bad++;
+    }
+    report("translate", n, now_ns() - s);
+    mmu_xlate_stats_t e = mmu_xlate_stats();
+    printk("%-16s %10u hits, %u misses\n", "", e.n_hits - st.n_hits, e.n_misses - st.n_misses);
+
+    st = e;
+    s = now_ns();
+    for(unsigned i = 0; i < n; i++) {
+        uint32_t va = SM_BASE + (i * 4) % (XLATE_HOT_PAGES * 4 * KB);
+        if(mmu_translate(pt, va, &x) != 4 * KB || x.pa != va)
+            bad++;
+    }
+    report("translate_hot", n, now_ns() - s);
+    e = mmu_xlate_stats();
+    printk("%-16s %10u hits, %u misses\n", "", e.n_hits - st.n_hits, e.n_misses - st.n_misses);
+    if(e.n_misses - st.n_misses != XLATE_HOT_PAGES) {
+        printk("ERROR: %u pages read over and over missed %u times\n",
+            XLATE_HOT_PAGES, e.n_misses - st.n_misses);
+        n_errors++;
+    }
+
+    // the software walk against the c7 hardware one (here, sim_translate):
+    // everything mapped, the gaps around it, and a permission abort.
+    bad += mmu_xlate_verify(pt, 0, LG_BASE + LG_N * 64 * KB + MB);
+    mmu_protect(pt, SM_BASE, F_NO_USR_WR_ACCESS);
+    uint32_t par = mmu_hw_translate(SM_BASE + 0x24, HW_XLATE_USER, HW_XLATE_WRITE);
+    bad += !HW_XLATE_ABORTED(par) || HW_XLATE_STATUS(par) != SIM_FAULT_PAGE_PERM;
+    par = mmu_hw_translate(SM_BASE + 0x24, HW_XLATE_USER, HW_XLATE_READ);
+    bad += HW_XLATE_ABORTED(par) || hw_xlate_pa(par, SM_BASE + 0x24) != SM_BASE + 0x24;
+    bad += mmu_xlate_verify(pt, SM_BASE, 4 * KB);
+    mmu_protect(pt, SM_BASE, F_FULL_ACCESS);
+
+    // every change must be seen by the very next translate.
+    // (in different cache slots, so one doesn't evict another).
+    uint32_t va = SM_BASE + 0x10, lva = LG_BASE + 0x1234, sva = 5 * MB + 0x7010;
+    bad += !xlate_ok(pt, va) + !xlate_ok(pt, lva) + !xlate_ok(pt, sva);
+    mmu_remap(pt, va, 0x123000);
+    bad += !xlate_ok(pt, va);
+    mmu_protect(pt, va, F_NO_USR_WR_ACCESS);
+    mmu_translate(pt, va, &x);
+    bad += !xlate_ok(pt, va) + (FGET_AP(x.flags) != FGET_AP(F_NO_USR_WR_ACCESS));
+    mmu_unmap(pt, va);
+    bad += !xlate_ok(pt, va);
+    mmu_map_sm_page(pt, va & ~(4 * KB - 1), 0x456000, BENCH_DOMAIN, 0);
+    bad += !xlate_ok(pt, va);
+    mmu_unmap(pt, lva);
+    bad += !xlate_ok(pt, lva);
+    mmu_unmap(pt, sva);
+    mmu_map_lg_page(pt, 5 * MB, 0x7f0000, BENCH_DOMAIN, 0);
+    bad += !xlate_ok(pt, sva);
+    mmu_map_range(pt, 256 * MB, LG_BASE, 16 * MB, 0, 0);
+    bad += !xlate_ok(pt, 257 * MB + 0x10);
+    mmu_unmap(pt, 256 * MB);
+    bad += !xlate_ok(pt, 257 * MB + 0x10);
+
+    // same va, another table at the same address after a free.
+    mmu_translate(pt, 0x10, &x);
+    pt = fresh_pt();
+    use_pt(pt);
+    mmu_map_section(pt, 0, 3 * MB, BENCH_DOMAIN, 0);
+    bad += !xlate_ok(pt, 0x10);
+
+    if(bad) {
+        printk("ERROR: %u translations wrong\n", bad);
+        n_errors += bad;
+    }
+}
+
+// fresh envs over a kernel mapped once in kernel_pt: the first 2MB (text,
+// stacks, heap) linked into every env, and the peripheral window in TTBR1.
+// the driver's tests map 1MB of heap at SYS_HEAP_START, and env tables come
+// out of it after env_init.
+#define TEST_HEAP_SIZE  MB
+static void env_setup(void) {
+    kfree_all();
+    pt_alloc_reset();
+    env_init();
+    uint32_t used = (uint8_t *)kmalloc_heap_end() - (uint8_t *)kmalloc_heap_start();
+    if(used > TEST_HEAP_SIZE / 2) {
+        printk("ERROR: env_init used %u KB of the %u KB test heap\n", used / KB, TEST_HEAP_SIZE / KB);
+        n_errors++;
+    }
+    mmu_map_range(kernel_pt, 0, 0, 2 * MB, KERNEL_DOMAIN, 0);
+    mmu_map_range(kernel_pt, PERIPHERAL_BASE, PERIPHERAL_BASE, PERIPHERAL_SIZE, KERNEL_DOMAIN, 0);
+}
+
+// round-robin context switches between envs that map the same user VA to
+// different frames over a shared, global kernel mapping. a switch must not
+// touch the TLB or caches: user entries are told apart by their ASID.
+#define ENV_N       4
+#define ENV_USER_VA (32 * MB)
+static void bench_env_switch(unsigned n) {
+    env_setup();
+
+    env_t *e[ENV_N];
+    for(unsigned i = 0; i < ENV_N; i++) {
+        e[i] = env_alloc();
+        env_map_range(e[i], ENV_USER_VA, (40 + i) * MB, MB, 0);
+    }
+
+    // each env's table covers user space only: 16KB >> N.
+    pt_stats_t st = pt_stats();
+    printk("%-16s %10u bytes of first-level tables per env\n", "",
+        (st.n_l1_bytes - PT_L1_SIZE) / ENV_N);
+    if(st.n_l1_bytes != PT_L1_SIZE + ENV_N * (PT_L1_SIZE >> ENV_TTBCR_N)) {
+        printk("ERROR: first-level tables take %u bytes\n", st.n_l1_bytes);
+        n_errors++;
+    }
+
+    sim_xlate_t x;
+    for(unsigned i = 0; i < ENV_N; i++) {
+        env_switch_to(e[i]);
+        expect(ENV_USER_VA + 0x1234, (40 + i) * MB + 0x1234, MB);
+        expect(0x8000, 0x8000, MB);
+        // above ENV_VA_LIMIT the walk goes through TTBR1.
+        expect(PERIPHERAL_BASE + 0x215000, PERIPHERAL_BASE + 0x215000, 16 * MB);
+        if(sim_translate(ENV_USER_VA, SIM_ACC_READ, &x) != SIM_OK || !x.not_global
+        || sim_translate(0x8000, SIM_ACC_READ, &x) != SIM_OK || x.not_global) {
+            printk("ERROR: env %u: user mapping must be non-global, kernel global\n", i);
+            n_errors++;
+        }
+    }
+
+    sim_cp15_t before = sim_cp15;
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i++)
+        env_switch_to(e[i % ENV_N]);
+    report("env_switch", n, now_ns() - s);
+
+    unsigned flushes = (sim_cp15.n_tlb_inv - before.n_tlb_inv)
+        + (sim_cp15.n_tlb_inv_mva - before.n_tlb_inv_mva)
+        + (sim_cp15.n_dcache_clean_inv - before.n_dcache_clean_inv)
+        + (sim_cp15.n_icache_inv - before.n_icache_inv);
+    if(flushes) {
+        printk("ERROR: env_switch did %u cache/TLB maintenance operations\n", flushes);
+        n_errors++;
+    }
+
+    mmu_disable();
+    for(unsigned i = 0; i < ENV_N; i++)
+        env_free(e[i]);
+}
+
+// a buffer in a named domain: 3MB of sections and a MB of small pages.
+// revoking and granting it is one DACR write each, against mmu_protect on
+// every page of the same buffer; then manager access skips a read-only page's
+// AP bits. none of the switching may touch the TLB.
+#define DOM_VA  0x18000000
+#define DOM_PA  (16 * MB)
+static void bench_domains(unsigned n) {
+    env_setup();
+    env_t *e = env_alloc();
+    env_map_range(e, DOM_VA, DOM_PA, 3 * MB, 0);
+    for(unsigned i = 0; i < 256; i++)
+        env_map_sm_page(e, DOM_VA + 3 * MB + i * 4 * KB, DOM_PA + 3 * MB + i * 4 * KB, 0);
+    env_switch_to(e);
+
+    unsigned bad = 0, d = env_domain_alloc("shared-buf");
+    bad += env_domain_lookup("shared-buf") != d || env_domain_lookup("device");
+    bad += env_domain_assign(e->pt, DOM_VA, 4 * MB, d) != 4;
+
+    sim_xlate_t x;
+    uint32_t sec = DOM_VA + MB + 0x10, page = DOM_VA + 3 * MB + 0x5010;
+    unsigned acc = SIM_ACC_WRITE | SIM_ACC_USER;
+    bad += sim_translate(sec, acc, &x) != SIM_OK || x.domain != d;
+    bad += sim_translate(page, acc, &x) != SIM_OK || x.domain != d;
+
+    unsigned ntlb = sim_cp15.n_tlb_inv + sim_cp15.n_tlb_inv_mva;
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i += 2) {
+        env_domain_set(d, DOMAIN_NO_ACCESS);
+        env_domain_set(d, DOMAIN_CLIENT);
+    }
+    report("domain_flip", n, now_ns() - s);
+    bad += sim_cp15.n_tlb_inv + sim_cp15.n_tlb_inv_mva != ntlb;
+
+    // the same revoke/grant by rewriting descriptors.
+    unsigned rounds = n / 1024 + 1, sz;
+    s = now_ns();
+    for(unsigned r = 0; r < rounds; r++)
+        for(uint32_t va = DOM_VA; va < DOM_VA + 4 * MB; va += sz)
+            sz = mmu_protect(e->pt, va, r & 1 ? F_FULL_ACCESS : F_NO_ACCESS);
+    report("protect_buffer", rounds, now_ns() - s);
+    for(uint32_t va = DOM_VA; va < DOM_VA + 4 * MB; va += sz)
+        sz = mmu_protect(e->pt, va, F_FULL_ACCESS);
+
+    env_domain_set(d, DOMAIN_NO_ACCESS);
+    bad += sim_translate(sec, SIM_ACC_READ, &x) != SIM_FAULT_SECTION_DOM;
+    bad += sim_translate(page, SIM_ACC_READ, &x) != SIM_FAULT_PAGE_DOM;
+    // the rest of the env, and the kernel, are untouched.
+    bad += sim_translate(0x1000, SIM_ACC_READ, &x) != SIM_OK;
+    bad += env_domain_set(d, DOMAIN_CLIENT) != DOMAIN_NO_ACCESS;
+    bad += sim_translate(page, acc, &x) != SIM_OK;
+
+    // manager: AP is not checked.
+    mmu_protect(e->pt, page, F_NO_USR_WR_ACCESS);
+    bad += sim_translate(page, acc, &x) != SIM_FAULT_PAGE_PERM;
+    uint32_t old = env_domains_set(DOMAIN_FIELD(d) | DOMAIN_FIELD(KERNEL_DOMAIN),
+        DOMAIN_MANAGER << d*2 | DOMAIN_MANAGER << KERNEL_DOMAIN*2);
+    bad += sim_translate(page, acc, &x) != SIM_OK;
+    bad += (cp15_domain_ctrl_rd() >> KERNEL_DOMAIN*2 & 0b11) != DOMAIN_MANAGER;
+    env_domains_set(DOMAIN_FIELD(d) | DOMAIN_FIELD(KERNEL_DOMAIN), old);
+    bad += sim_translate(page, acc, &x) != SIM_FAULT_PAGE_PERM;
+
+    // holds across a switch to another env and back.
+    env_t *e2 = env_alloc();
+    env_domain_set(d, DOMAIN_NO_ACCESS);
+    env_switch_to(e2);
+    env_switch_to(e);
+    bad += sim_translate(sec, SIM_ACC_READ, &x) != SIM_FAULT_SECTION_DOM;
+    bad += (cp15_domain_ctrl_rd() & DOMAIN_FIELD(e->domain)) != DOMAIN_CLIENT << e->domain*2;
+
+    mmu_disable();
+    env_domain_free(d);
+    bad += env_domain_lookup("shared-buf") != 0;
+    env_free(e2);
+    env_free(e);
+
+    if(bad) {
+        printk("ERROR: %u named domain checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// create, run and destroy envs in a loop, the way a test runner would. after
+// the first round every page table comes out of the pools, so the heap must
+// not move.
+static void bench_env_churn(unsigned n) {
+    env_setup();
+
+    env_t *idle = env_alloc();
+    env_switch_to(idle);
+
+    void *heap = 0;
+    unsigned rounds = n / 256 + 1;
+    double s = now_ns();
+    for(unsigned i = 0; i < rounds; i++) {
+        env_t *e = env_alloc();
+        env_map_range(e, ENV_USER_VA + 0x3000, 40 * MB + 0x3000, 3 * MB, 0);
+        env_map_sm_page(e, 100 * MB + (i % 256) * 4 * KB, 41 * MB, 0);
+
+        env_switch_to(e);
+        expect(ENV_USER_VA + 0x3010, 40 * MB + 0x3010, 4 * KB);
+        env_switch_to(idle);
+        env_free(e);
+
+        if(!i)
+            heap = kmalloc_heap_end();
+    }
+    report("env_churn", rounds, now_ns() - s);
+
+    pt_stats_t st = pt_stats();
+    if(kmalloc_heap_end() != heap || st.n_l1_used != 2 || st.n_used != 0) {
+        printk("ERROR: env teardown leaked: heap grew %d bytes, %u L1 / %u coarse tables live\n",
+            (int)((char *)kmalloc_heap_end() - (char *)heap), st.n_l1_used, st.n_used);
+        n_errors++;
+    }
+
+    mmu_disable();
+    env_free(idle);
+}
+
+// data_abort_fast for a write that walked to fault <x>: the same fixes, and
+// counted and timed the same way.
+static int sim_abort(env_t *e, uint32_t va, sim_xlate_t *x) {
+    uint32_t start = cp15_cycle_cnt_rd();
+    int fixed = 0;
+    switch(x->status) {
+    case SIM_FAULT_SECTION_XLATE:
+    case SIM_FAULT_PAGE_XLATE:
+        if((fixed = vm_swap_fault(e, va)))
+            break;
+        if((fixed = vma_fault(e, va)))
+            vm_dirty_mark(e, va);
+        break;
+    case SIM_FAULT_SECTION_PERM:
+    case SIM_FAULT_PAGE_PERM:
+        if((fixed = vm_age_fault(e, va)))
+            break;
+        if((fixed = cow_fault(e->pt, va)))
+            vm_dirty_mark(e, va);
+        else
+            fixed = vm_dirty_fault(e, va);
+        break;
+    }
+    // section translation faults leave the domain field invalid (B4-20).
+    fault_stats_record(e, x->status,
+        x->status == SIM_FAULT_SECTION_XLATE ? FAULT_NO_DOMAIN : x->domain,
+        fixed, cp15_cycle_cnt_rd() - start);
+    return fixed;
+}
+
+// fork an env with an unaligned user range (sections, large and small pages),
+// then write every page from the child and then from the parent the way the
+// data abort handler would: the child's writes copy, the parent's just take
+// the frame back. forks are timed against a fresh child each round.
+#define FORK_VA     (ENV_USER_VA + 0x3000)
+#define FORK_PA     (40 * MB + 0x3000)
+#define FORK_LEN    (3 * MB)
+static unsigned write_all(env_t *e, uint32_t *pa) {
+    unsigned n = 0;
+    sim_xlate_t x;
+    env_switch_to(e);
+    for(uint32_t va = FORK_VA; va < FORK_VA + FORK_LEN; va += x.size, n++) {
+        if(sim_translate(va, SIM_ACC_WRITE, &x) == SIM_OK
+        || !sim_abort(e, va, &x)
+        || sim_translate(va, SIM_ACC_WRITE, &x) != SIM_OK) {
+            printk("ERROR: va=0x%x: write fault not resolved by cow\n", va);
+            n_errors++;
+            return n;
+        }
+        va -= va % x.size;
+        pa[n] = x.pa - x.pa % x.size;
+        if(memcmp(sim_pa_to_ptr(x.pa - x.pa % x.size),
+                  sim_pa_to_ptr(FORK_PA + (va - FORK_VA)), x.size)) {
+            printk("ERROR: va=0x%x: copy does not match the original\n", va);
+            n_errors++;
+        }
+    }
+    return n;
+}
+
+static void bench_fork(unsigned n) {
+    env_setup();
+
+    env_t *p = env_alloc();
+    env_map_range(p, FORK_VA, FORK_PA, FORK_LEN, 0);
+    for(uint32_t off = 0; off < FORK_LEN; off += 4)
+        *(uint32_t *)sim_pa_to_ptr(FORK_PA + off) = off * 2654435761u;
+    env_switch_to(p);
+
+    unsigned rounds = n / 1024 + 1;
+    double s = now_ns();
+    for(unsigned i = 0; i < rounds; i++)
+        env_free(env_fork(p));
+    report("fork", rounds, now_ns() - s);
+
+    env_t *c = env_fork(p);
+    cow_stats_t st0 = cow_stats();
+
+    static uint32_t cpa[1024], ppa[1024];
+    unsigned nc = write_all(c, cpa), np = write_all(p, ppa);
+    cow_stats_t st = cow_stats();
+    printk("%-16s %10u mappings shared, %u copied, %u reused\n", "",
+        nc, st.n_copied - st0.n_copied, st.n_reused - st0.n_reused);
+
+    if(nc != np || st.n_copied - st0.n_copied != nc || st.n_reused - st0.n_reused != np) {
+        printk("ERROR: expected %u copies then %u reuses\n", nc, np);
+        n_errors++;
+    }
+    // the parent kept its frames, the child got new ones.
+    for(unsigned i = 0; i < nc && i < np; i++)
+        if(ppa[i] < FORK_PA - 0x3000 || ppa[i] >= FORK_PA + FORK_LEN
+        || (cpa[i] >= FORK_PA - 0x3000 && cpa[i] < FORK_PA + FORK_LEN)) {
+            printk("ERROR: mapping %u: parent frame 0x%x, child frame 0x%x\n", i, ppa[i], cpa[i]);
+            n_errors++;
+        }
+
+    // kernel mapping is global and still writable in the child.
+    sim_xlate_t x;
+    env_switch_to(c);
+    if(sim_translate(0x8000, SIM_ACC_WRITE, &x) != SIM_OK || x.not_global) {
+        printk("ERROR: fork changed the kernel mapping\n");
+        n_errors++;
+    }
+
+    // the child's copies are frames, and go back when it does.
+    uint32_t in_use = frame_stats().n_bytes - frame_stats().n_free;
+    env_switch_to(p);
+    env_free(c);
+    if(in_use == 0 || frame_stats().n_free != frame_stats().n_bytes) {
+        printk("ERROR: %u bytes of copies, %u still allocated after the child exits\n",
+            in_use, frame_stats().n_bytes - frame_stats().n_free);
+        n_errors++;
+    }
+    mmu_disable();
+    env_free(p);
+}
+
+// a 256MB anonymous region, a 1MB stack and a device window: reserving them
+// must be free, and only touched pages may cost memory. every access goes
+// through the fault path the way data_abort_vector drives it.
+#define ANON_VA     (0x08000000 + 0x3000)
+#define ANON_LEN    (256 * MB)
+#define STACK_TOP   (0x1f000000)
+#define DEV_VA      (0x1c000000)
+static int touch(env_t *e, uint32_t va, sim_xlate_t *x) {
+    if(sim_translate(va, SIM_ACC_WRITE, x) == SIM_OK)
+        return 1;
+    return sim_abort(e, va, x) && sim_translate(va, SIM_ACC_WRITE, x) == SIM_OK;
+}
+
+// 64KB of kernel small pages in a coarse table below ENV_VA_LIMIT, linked
+// into every env: an env's own pages in the same MB (mapped, demand paged,
+// forked) must stay out of the kernel's table, promoting an env whose region
+// covers the kernel's pages must not touch them, and freeing the envs must
+// leave the table alone.
+#define LINK_VA     (4 * MB)
+#define LINK_MAP    (LINK_VA + 128 * KB)
+#define LINK_ANON   (LINK_VA + 192 * KB)
+static void check_kernel_link(void) {
+    env_setup();
+    for(uint32_t off = 0; off < 64 * KB; off += 4 * KB)
+        mmu_map_sm_page(kernel_pt, LINK_VA + off, LINK_VA + off, KERNEL_DOMAIN, 0);
+    env_t *p = env_alloc(), *other = env_alloc();
+    vma_add(p, LINK_ANON, 64 * KB, VMA_ANON, 0);
+    vma_add(other, LINK_VA, 64 * KB, VMA_ANON, 0);
+    unsigned bad = 0;
+    uint32_t pa, fpa = frame_alloc(4 * KB);
+    int flags;
+
+    env_map_sm_page(p, LINK_MAP, fpa, 0);
+    mmu_sync_map(p->pt, LINK_MAP);
+    sim_xlate_t x;
+    env_switch_to(p);
+    if(!touch(p, LINK_ANON, &x))
+        bad++;
+    env_t *c = env_fork(p);
+
+    // in p and its child, not in the kernel or anyone else.
+    bad += mmu_query(kernel_pt, LINK_MAP, &pa, &flags) != 0
+        || mmu_query(kernel_pt, LINK_ANON, &pa, &flags) != 0
+        || mmu_query(other->pt, LINK_MAP, &pa, &flags) != 0;
+    bad += mmu_query(c->pt, LINK_MAP, &pa, &flags) != 4 * KB || pa != fpa
+        || mmu_query(c->pt, LINK_ANON, &pa, &flags) != 64 * KB;
+    // the kernel's pages are still there for all of them, still small.
+    env_switch_to(c);
+    bad += sim_translate(LINK_VA, SIM_ACC_READ, &x) != SIM_OK || x.pa != LINK_VA || x.not_global;
+    bad += env_promote(other) != 0;
+    bad += mmu_query(kernel_pt, LINK_VA, &pa, &flags) != 4 * KB;
+
+    mmu_disable();
+    env_free(c);
+    env_free(p);
+    env_free(other);
+    frame_release(fpa, 4 * KB);
+    // frames back, and the kernel's table neither freed nor written.
+    frame_stats_t fs = frame_stats();
+    bad += fs.n_free != fs.n_bytes;
+    uint32_t *t = pt_coarse_alloc();
+    bad += mmu_query(kernel_pt, LINK_VA + 60 * KB, &pa, &flags) != 4 * KB || pa != LINK_VA + 60 * KB;
+    pt_coarse_free(t);
+
+    if(bad) {
+        printk("ERROR: %u kernel table sharing checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+static void bench_demand(unsigned n) {
+    check_kernel_link();
+    env_setup();
+    fault_stats_init();
+
+    env_t *e = env_alloc();
+
+    double s = now_ns();
+    vma_add(e, ANON_VA, ANON_LEN, VMA_ANON, 0);
+    vma_add(e, STACK_TOP - MB, MB, VMA_STACK, 0);
+    vma_add_device(e, DEV_VA, PERIPHERAL_BASE_SIM, MB, 0);
+    report("vma_add", 3, now_ns() - s);
+    env_switch_to(e);
+
+    // random touches: each 64KB block is committed once.
+    unsigned touches = n / 64 + 1, faults = 0, bad = 0;
+    uint32_t seed = 0x1b873593;
+    sim_xlate_t x;
+    s = now_ns();
+    for(unsigned i = 0; i < touches; i++) {
+        uint32_t va = ANON_VA + xorshift(&seed) % (16 * MB);
+        unsigned before = vma_lookup(e, va)->committed;
+        if(!touch(e, va, &x) || *(uint32_t *)sim_pa_to_ptr(x.pa & ~3) != 0)
+            bad++;
+        faults += vma_lookup(e, va)->committed != before;
+    }
+    report("demand_touch", touches, now_ns() - s);
+    printk("%-16s %10u faults, %u KB committed of a %u MB region\n", "",
+        faults, vma_committed(e) / KB, ANON_LEN / MB);
+    // only the touched 16MB (plus the block it ends in) may be committed.
+    if(vma_committed(e) > 16 * MB + 64 * KB)
+        bad++;
+
+    // stack: 4KB at a time, growing down.
+    for(uint32_t va = STACK_TOP - 4; va > STACK_TOP - 64 * KB; va -= 4 * KB)
+        if(!touch(e, va, &x) || x.size != 4 * KB)
+            bad++;
+    // device: whole window on the first touch, identity offset.
+    if(!touch(e, DEV_VA + 0x1234, &x) || x.pa != PERIPHERAL_BASE_SIM + 0x1234
+    || vma_lookup(e, DEV_VA)->committed != MB)
+        bad++;
+    // outside every region: not ours.
+    if(touch(e, ANON_VA - 4 * KB, &x) || touch(e, STACK_TOP, &x))
+        bad++;
+
+    // every abort counted once, under this env; only the last two not fixed.
+    fault_stats_t fst = fault_stats();
+    uint64_t env_cycles;
+    unsigned n_hist = 0, n_status = 0;
+    for(unsigned i = 0; i < FAULT_HIST_BUCKETS; i++)
+        n_hist += fst.hist[i];
+    for(unsigned i = 0; i < FAULT_N_STATUS; i++)
+        n_status += fst.n_status[i];
+    if(fst.n_faults - fst.n_fixed != 2 || fst.n_fixed < faults
+    || fault_stats_env(e, &env_cycles) != fst.n_faults || env_cycles != fst.cycles
+    || n_hist != fst.n_faults || n_status != fst.n_faults
+    || fst.n_status[SIM_FAULT_PAGE_XLATE] + fst.n_status[SIM_FAULT_SECTION_XLATE] != fst.n_faults)
+        bad++;
+    fault_stats_dump();
+
+    mmu_disable();
+    env_free(e);
+    // every committed frame goes back, merged into whole 1MB blocks.
+    frame_stats_t fs = frame_stats();
+    if(fs.n_free != fs.n_bytes || fs.n_free_max != fs.n_bytes / MB)
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u demand paging checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// commit DIRTY_BLOCKS 64KB blocks, track the env and write a random subset
+// through the abort path: collect must return exactly those blocks, each
+// faulting once per round, with reads never faulting. untracking gives every
+// block its write access back; a fork hands tracked pages to COW, whose
+// copies are still marked.
+#define DIRTY_VA        (ANON_VA - 0x3000 + 64 * KB)
+#define DIRTY_BLOCKS    256
+#define DIRTY_SEC_VA    (ANON_VA - 0x3000 + 32 * MB)
+static unsigned n_aborts(void) {
+    return fault_stats().n_faults;
+}
+
+static void bench_dirty(unsigned n) {
+    env_setup();
+    fault_stats_init();
+
+    env_t *e = env_alloc();
+    vma_add(e, ANON_VA, ANON_LEN, VMA_ANON, 0);
+    env_switch_to(e);
+
+    unsigned bad = 0;
+    sim_xlate_t x;
+    for(unsigned i = 0; i < DIRTY_BLOCKS; i++)
+        if(!touch(e, DIRTY_VA + i * 64 * KB, &x) || x.size != 64 * KB)
+            bad++;
+
+    double s = now_ns();
+    vm_dirty_track(e);
+    report("dirty_track", DIRTY_BLOCKS, now_ns() - s);
+    if(vm_dirty_collect(e, 0))
+        bad++;
+
+    static uint32_t out[VM_DIRTY_WORDS];
+    char want[DIRTY_BLOCKS];
+    unsigned writes = DIRTY_BLOCKS / 2, blocks = 0;
+    uint32_t seed = 0x85ebca6b;
+    memset(want, 0, sizeof want);
+    for(unsigned i = 0; i < writes; i++) {
+        unsigned b = xorshift(&seed) % (DIRTY_BLOCKS * 64 * KB) / (64 * KB);
+        blocks += !want[b];
+        want[b] = 1;
+    }
+
+    for(unsigned round = 0; round < 2; round++) {
+        unsigned before = n_aborts();
+        seed = 0x85ebca6b;
+        s = now_ns();
+        for(unsigned i = 0; i < writes; i++) {
+            uint32_t va = DIRTY_VA + xorshift(&seed) % (DIRTY_BLOCKS * 64 * KB);
+            if(!touch(e, va, &x))
+                bad++;
+        }
+        report("dirty_write", writes, now_ns() - s);
+        // one fault per written block, each round.
+        if(n_aborts() - before != blocks)
+            bad++;
+
+        before = n_aborts();
+        for(unsigned i = 0; i < DIRTY_BLOCKS; i++)
+            if(sim_translate(DIRTY_VA + i * 64 * KB + 8, SIM_ACC_READ, &x) != SIM_OK)
+                bad++;
+        if(n_aborts() != before)
+            bad++;
+
+        s = now_ns();
+        unsigned got = vm_dirty_collect(e, out);
+        report("dirty_collect", 1, now_ns() - s);
+        if(got != blocks * 16)
+            bad++;
+        for(unsigned i = 0; i < DIRTY_BLOCKS; i++) {
+            uint32_t page = (DIRTY_VA + i * 64 * KB) / (4 * KB);
+            if((out[page / 32] >> page % 32 & 0xffff) != (want[i] ? 0xffff : 0))
+                bad++;
+        }
+        if(vm_dirty_collect(e, 0))
+            bad++;
+    }
+    printk("%-16s %10u of %u blocks dirty per round\n", "", blocks, DIRTY_BLOCKS);
+
+    // untracked: everything writable again, no faults.
+    vm_dirty_untrack(e);
+    for(unsigned i = 0; i < DIRTY_BLOCKS; i++)
+        if(sim_translate(DIRTY_VA + i * 64 * KB, SIM_ACC_WRITE, &x) != SIM_OK)
+            bad++;
+
+    // tracked across a fork: the parent's writes are COW faults now (taking
+    // the frame back once the child is gone), and still dirty it.
+    vm_dirty_track(e);
+    env_t *c = env_fork(e);
+    env_switch_to(e);
+    if(!touch(e, DIRTY_VA, &x) || vm_dirty_collect(e, 0) != 16)
+        bad++;
+    env_switch_to(c);
+    if(!touch(c, DIRTY_VA + 64 * KB, &x))
+        bad++;
+    // e isn't running: protecting or unprotecting its pages has to drop its
+    // TLB entries too, not just the running env's.
+    sim_cp15.last_inv_asid = 0;
+    vm_dirty_untrack(e);
+    bad += sim_cp15.last_inv_asid != e->asid;
+    sim_cp15.last_inv_asid = 0;
+    vm_dirty_track(e);
+    bad += sim_cp15.last_inv_asid != e->asid;
+    mmu_disable();
+    env_free(c);
+    env_switch_to(e);
+    if(!touch(e, DIRTY_VA + 2 * 64 * KB, &x) || vm_dirty_collect(e, 0) != 16)
+        bad++;
+
+    mmu_disable();
+    env_free(e);
+
+    // a dirty section is 256 dirty pages, in the count as well as in <out>:
+    // its bits run across 8 words of the bitmap.
+    e = env_alloc();
+    vma_add(e, DIRTY_SEC_VA, MB, VMA_ANON, 0);
+    env_map_section(e, DIRTY_SEC_VA, frame_alloc(MB), 0);
+    env_switch_to(e);
+    vm_dirty_track(e);
+    if(!touch(e, DIRTY_SEC_VA + 5 * 4 * KB, &x) || x.size != MB)
+        bad++;
+    unsigned got = vm_dirty_collect(e, out), set = 0;
+    for(unsigned w = 0; w < VM_DIRTY_WORDS; w++)
+        set += __builtin_popcount(out[w]);
+    if(got != MB / (4 * KB) || set != got)
+        bad++;
+    mmu_disable();
+    env_free(e);
+
+    frame_stats_t fs = frame_stats();
+    if(fs.n_free != fs.n_bytes)
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u dirty tracking checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// a user access, with each fault resolved the way data_abort_fast would and
+// the access retried: the number of faults taken, -1 if one was not fixed.
+static int user_access(env_t *e, uint32_t va, unsigned acc, sim_xlate_t *x) {
+    for(int n = 0; n < 4; n++) {
+        if(sim_translate(va, acc | SIM_ACC_USER, x) == SIM_OK)
+            return n;
+        if(!sim_abort(e, va, x))
+            return -1;
+    }
+    return -1;
+}
+
+// commit AGE_BLOCKS 64KB blocks, then touch only the first AGE_HOT of them
+// every period. once the cold blocks have been idle for VM_AGE_WINDOW scans,
+// the estimate must be exactly the hot set, each hot block must cost one
+// fault per period, and the ages must have shifted the right way. then the
+// same env is dirty tracked, forked and freed while hidden: nothing leaks.
+#define AGE_VA      DIRTY_VA
+#define AGE_BLOCKS  256
+#define AGE_HOT     64
+#define AGE_SCANS   6
+static void bench_age(unsigned n) {
+    env_setup();
+    fault_stats_init();
+
+    env_t *e = env_alloc();
+    vma_add(e, ANON_VA, ANON_LEN, VMA_ANON, 0);
+    env_switch_to(e);
+
+    unsigned bad = 0;
+    sim_xlate_t x;
+    for(unsigned i = 0; i < AGE_BLOCKS; i++)
+        if(user_access(e, AGE_VA + i * 64 * KB, SIM_ACC_WRITE, &x) != 1)
+            bad++;
+
+    vm_age_start(e);
+    double scan_ns = 0, touch_ns = 0;
+    unsigned hot_faults = 0;
+    uint32_t wss = 0;
+    for(unsigned scan = 0; scan < AGE_SCANS; scan++) {
+        double s = now_ns();
+        wss = vm_age_scan(e);
+        scan_ns += now_ns() - s;
+        // the first scan sees everything committed since vm_age_start.
+        if(scan == 0 && wss != AGE_BLOCKS * 64 * KB)
+            bad++;
+
+        unsigned before = n_aborts();
+        s = now_ns();
+        for(unsigned i = 0; i < AGE_HOT; i++)
+            for(unsigned k = 0; k < 4; k++)
+                if(user_access(e, AGE_VA + i * 64 * KB + k * 4 * KB, SIM_ACC_READ, &x) < 0)
+                    bad++;
+        touch_ns += now_ns() - s;
+        hot_faults += n_aborts() - before;
+    }
+    wss = vm_age_scan(e);
+    report("age_scan", (AGE_SCANS + 1) * AGE_BLOCKS, scan_ns);
+    report("age_fault", hot_faults, touch_ns);
+    printk("%-16s %10u KB working set of %u KB committed\n", "",
+        wss / KB, vma_committed(e) / KB);
+
+    // hot: touched every period. cold: only before the first scan.
+    unsigned hot_age = (0xff00 >> (AGE_SCANS + 1)) & 0xff, cold_age = 0x80 >> AGE_SCANS;
+    if(wss != AGE_HOT * 64 * KB || hot_faults != AGE_SCANS * AGE_HOT
+    || vm_age_of(e, AGE_VA) != hot_age
+    || vm_age_of(e, AGE_VA + (AGE_BLOCKS - 1) * 64 * KB + 8 * KB) != cold_age)
+        bad++;
+
+    // a write to a hidden page under dirty tracking: aging gives it back, then
+    // dirty tracking marks it.
+    vm_dirty_track(e);
+    if(user_access(e, AGE_VA + 5 * 64 * KB, SIM_ACC_WRITE, &x) != 2
+    || vm_dirty_collect(e, 0) != 16)
+        bad++;
+
+    // fork and free with pages hidden: the child copies one on its write,
+    // and every frame still comes back.
+    env_t *c = env_fork(e);
+    env_switch_to(c);
+    if(user_access(c, AGE_VA + 200 * 64 * KB, SIM_ACC_WRITE, &x) != 1)
+        bad++;
+    // e isn't running: hiding its pages, or giving them back, has to drop its
+    // TLB entries too, or it keeps using them unseen.
+    sim_cp15.last_inv_asid = 0;
+    vm_age_scan(e);
+    bad += sim_cp15.last_inv_asid != e->asid;
+    sim_cp15.last_inv_asid = 0;
+    vm_age_release(e);
+    bad += sim_cp15.last_inv_asid != e->asid;
+    env_switch_to(e);
+    vm_age_scan(e);
+    mmu_disable();
+    env_free(c);
+    env_free(e);
+    frame_stats_t fs = frame_stats();
+    if(fs.n_free != fs.n_bytes)
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u page aging checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// contents for the swap bench: block i is all zero, compressible (a short
+// repeating record with the block number in it) or random, by i % 4.
+#define SWAP_BLOCKS 128
+#define SWAP_HOT    32
+static void swap_fill(uint32_t *p, unsigned i, unsigned n) {
+    uint32_t seed = 0x27d4eb2f + i;
+    for(unsigned k = 0; k < n / 4; k++)
+        switch(i % 4) {
+        case 0: p[k] = 0; break;
+        case 3: p[k] = xorshift(&seed); break;
+        default: p[k] = i << 16 | (k % 24) * 0x0101; break;
+        }
+}
+
+static int swap_check(env_t *e, unsigned i) {
+    static uint32_t want[64 * KB / 4];
+    sim_xlate_t x;
+    uint32_t va = AGE_VA + i * 64 * KB;
+    if(sim_translate(va, SIM_ACC_READ, &x) != SIM_OK || x.size != 64 * KB)
+        return 0;
+    swap_fill(want, i, 64 * KB);
+    return !memcmp(sim_pa_to_ptr(x.pa), want, 64 * KB);
+}
+
+static void check_lz(void) {
+    static uint8_t in[64 * KB], out[64 * KB], back[64 * KB];
+    unsigned bad = 0;
+    for(unsigned i = 0; i < 4; i++) {
+        swap_fill((uint32_t *)in, i, sizeof in);
+        unsigned clen = lz_compress(in, sizeof in, out, sizeof out);
+        // random data doesn't fit in its own size; everything else must and
+        // must come back exactly.
+        if(i % 4 == 3) {
+            bad += clen != 0;
+            continue;
+        }
+        if(!clen || !lz_decompress(out, clen, back, sizeof back)
+        || memcmp(in, back, sizeof in)
+        || lz_decompress(out, clen / 2, back, sizeof back)
+        || lz_decompress(out, clen, back, sizeof back - 4))
+            bad++;
+    }
+    // short inputs and ones with no match at all.
+    const uint8_t abc[] = "abcabcabcabcabcabcabcabcabcabcabcab";
+    unsigned clen = lz_compress(abc, sizeof abc, out, sizeof out);
+    if(!lz_decompress(out, clen, back, sizeof abc) || memcmp(abc, back, sizeof abc)
+    || !(clen = lz_compress(abc, 3, out, sizeof out)) || !lz_decompress(out, clen, back, 3))
+        bad++;
+    if(bad) {
+        printk("ERROR: %u lz codec checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// age an env until all but its hot blocks are cold and swap those out: zero
+// blocks take no pool, random ones stay, the rest compress. every block must
+// read back what was written, and nothing may leak through fork and free.
+static void bench_swap(unsigned n) {
+    check_lz();
+    env_setup();
+    fault_stats_init();
+
+    env_t *e = env_alloc();
+    vma_add(e, ANON_VA, ANON_LEN, VMA_ANON, 0);
+    env_switch_to(e);
+
+    unsigned bad = 0;
+    sim_xlate_t x;
+    for(unsigned i = 0; i < SWAP_BLOCKS; i++) {
+        if(user_access(e, AGE_VA + i * 64 * KB, SIM_ACC_WRITE, &x) != 1)
+            bad++;
+        swap_fill(sim_pa_to_ptr(x.pa), i, 64 * KB);
+    }
+    // off until asked for: env_init doesn't spend the heap on a pool.
+    if(vm_swap_out(e, AGE_VA) || vm_swap_cold(e, ~0u)) {
+        printk("ERROR: swapped out with no pool\n");
+        n_errors++;
+    }
+    swap_init(SWAP_POOL_SIZE);
+
+    vm_age_start(e);
+    for(unsigned scan = 0; scan <= VM_AGE_WINDOW + 1; scan++) {
+        vm_age_scan(e);
+        for(unsigned i = 0; i < SWAP_HOT; i++)
+            if(user_access(e, AGE_VA + i * 64 * KB, SIM_ACC_READ, &x) < 0)
+                bad++;
+    }
+
+    frame_stats_t before = frame_stats();
+    uint32_t committed = vma_committed(e);
+    double s = now_ns();
+    uint32_t freed = vm_swap_cold(e, ~0u);
+    double out_ns = now_ns() - s;
+    swap_stats_t st = swap_stats();
+    report("swap_out", st.n_out + st.n_rejected, out_ns);
+    swap_stats_dump();
+    // the cold blocks minus the random quarter.
+    unsigned cold = SWAP_BLOCKS - SWAP_HOT, gone = cold - cold / 4;
+    if(freed != gone * 64 * KB || st.n_out != gone || st.n_zero != cold / 4
+    || st.n_rejected != cold / 4 || frame_stats().n_free != before.n_free + freed
+    || vma_committed(e) != committed - freed || e->n_swapped != gone
+    || st.pool_bytes >= st.bytes / 4)
+        bad++;
+
+    // back in on the first touch: the swap fault, then aging's (the page was
+    // hidden when it went).
+    unsigned faults = 0;
+    s = now_ns();
+    for(unsigned i = SWAP_HOT; i < SWAP_BLOCKS; i++) {
+        int f = user_access(e, AGE_VA + i * 64 * KB + 4 * KB, SIM_ACC_READ, &x);
+        faults += f > 0 ? f : 0;
+        if(f != (i % 4 == 3 ? 1 : 2) || !swap_check(e, i))
+            bad++;
+    }
+    report("swap_in", gone, now_ns() - s);
+    printk("%-16s %10u cycles per fault-in, %u max\n", "",
+        (unsigned)(swap_stats().in_cycles / gone), swap_stats().in_max_cycles);
+    if(swap_stats().n_entries || e->n_swapped || vma_committed(e) != committed)
+        bad++;
+
+    // trackers letting go while a page is out: it comes back with the access
+    // they'd have given it.
+    if(!vm_swap_out(e, AGE_VA + 65 * 64 * KB))
+        bad++;
+    vm_age_stop(e);
+    if(user_access(e, AGE_VA + 65 * 64 * KB, SIM_ACC_READ, &x) != 1)
+        bad++;
+    vm_dirty_track(e);
+    if(!vm_swap_out(e, AGE_VA + 66 * 64 * KB))
+        bad++;
+    vm_dirty_untrack(e);
+    if(user_access(e, AGE_VA + 66 * 64 * KB, SIM_ACC_WRITE, &x) != 1
+    || *(uint32_t *)sim_pa_to_ptr(x.pa) != (66u << 16))
+        bad++;
+    // and one that kept tracking: a read leaves it clean and protected.
+    vm_dirty_track(e);
+    if(!vm_swap_out(e, AGE_VA + 69 * 64 * KB)
+    || user_access(e, AGE_VA + 69 * 64 * KB, SIM_ACC_READ, &x) != 1
+    || vm_dirty_collect(e, 0) != 0
+    || user_access(e, AGE_VA + 69 * 64 * KB, SIM_ACC_WRITE, &x) != 1
+    || vm_dirty_collect(e, 0) != 16)
+        bad++;
+    vm_dirty_untrack(e);
+
+    // a fork swaps the parent in; the child sees the contents.
+    if(!vm_swap_out(e, AGE_VA + 70 * 64 * KB))
+        bad++;
+    env_t *c = env_fork(e);
+    env_switch_to(c);
+    if(e->n_swapped || !swap_check(c, 70))
+        bad++;
+
+    // free with pages out: their entries and pool space go too. pages still
+    // shared copy-on-write can't go; a write makes them private.
+    // swapping out of an env that isn't running flushes its ASID.
+    if(vm_swap_out(c, AGE_VA + 2 * 64 * KB)
+    || user_access(c, AGE_VA + 2 * 64 * KB, SIM_ACC_WRITE, &x) != 1)
+        bad++;
+    env_switch_to(e);
+    sim_cp15.last_inv_asid = 0;
+    if(!vm_swap_out(c, AGE_VA + 2 * 64 * KB) || sim_cp15.last_inv_asid != c->asid)
+        bad++;
+    if(user_access(e, AGE_VA + 1 * 64 * KB, SIM_ACC_WRITE, &x) != 1
+    || !vm_swap_out(e, AGE_VA + 1 * 64 * KB))
+        bad++;
+    mmu_disable();
+    env_free(c);
+    env_free(e);
+    frame_stats_t fs = frame_stats();
+    st = swap_stats();
+    if(fs.n_free != fs.n_bytes || st.n_entries || st.pool_bytes)
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u swap checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// fill PROMO_MB of small pages the way demand paging would leave a region
+// once it has been touched everywhere, spoil one 64KB slot in each of the last
+// two MB (a stray frame, a read-only page), and promote.
+#define PROMO_VA    0x10000000
+#define PROMO_PA    (8 * MB)
+#define PROMO_MB    8
+#define PROMO_N     (6 * (16 + 1) + 2 * 15)   // 6 full MB, then 15 large pages twice
+
+static void promo_fill(fld_t *pt) {
+    for(uint32_t off = 0; off < PROMO_MB * MB; off += 4 * KB) {
+        uint32_t pa = PROMO_PA + off;
+        int flags = 0;
+        if(off == 6 * MB + 17 * 4 * KB)
+            pa = 48 * MB;
+        if(off == 7 * MB + 3 * 64 * KB + 5 * 4 * KB)
+            flags = F_NO_USR_WR_ACCESS;
+        mmu_map_sm_page(pt, PROMO_VA + off, pa, BENCH_DOMAIN, flags);
+    }
+}
+
+static void bench_promote(unsigned n) {
+    unsigned ops = 0, np = 0, bad = 0;
+    double t = 0;
+    fld_t *pt = 0;
+
+    while(ops < n) {
+        pt = fresh_pt();
+        promo_fill(pt);
+        double s = now_ns();
+        np = mmu_promote(pt, PROMO_VA, PROMO_MB * MB);
+        t += now_ns() - s;
+        ops += PROMO_MB * 256;
+    }
+    report("promote", ops, t);
+    pt_stats_t st = pt_stats();
+    printk("%-16s %10u promotions, %u of %u coarse tables left\n", "",
+        np, st.n_used, PROMO_MB);
+    if(np != PROMO_N || st.n_used != 2)
+        bad++;
+
+    use_pt(pt);
+    for(uint32_t off = 0; off < PROMO_MB * MB; off += 4 * KB) {
+        uint32_t va = PROMO_VA + off, pa = PROMO_PA + off;
+        unsigned sz = off < 6 * MB ? MB : 64 * KB;
+        if(off >= 6 * MB + 16 * 4 * KB && off < 6 * MB + 32 * 4 * KB) {
+            sz = 4 * KB;
+            if(off == 6 * MB + 17 * 4 * KB)
+                pa = 48 * MB;
+        }
+        if(off >= 7 * MB + 3 * 64 * KB && off < 7 * MB + 4 * 64 * KB) {
+            sz = 4 * KB;
+            if(off == 7 * MB + 3 * 64 * KB + 5 * 4 * KB)
+                continue;   // read-only: expect() writes
+        }
+        expect(va + 0x10, pa + 0x10, sz);
+    }
+
+    // a range that misses the first 4KB of a MB promotes the other 15 slots
+    // and leaves the coarse table.
+    pt = fresh_pt();
+    for(uint32_t off = 0; off < MB; off += 4 * KB)
+        mmu_map_sm_page(pt, PROMO_VA + off, PROMO_PA + off, BENCH_DOMAIN, 0);
+    if(mmu_promote(pt, PROMO_VA + 4 * KB, MB - 4 * KB) != 15 || pt_stats().n_used != 1)
+        bad++;
+    // a second pass over all of it finishes the job.
+    if(mmu_promote(pt, PROMO_VA, MB) != 2 || pt_stats().n_used != 0)
+        bad++;
+
+    // a TEX/C/B no MEM_* encodes (TEX=011 is reserved) reads back as
+    // MEM_UNKNOWN, and promotion leaves it be rather than pick a type.
+    pt = fresh_pt();
+    for(uint32_t off = 0; off < 64 * KB; off += 4 * KB)
+        ((sm_page_desc_t *)mmu_map_sm_page(pt, PROMO_VA + off, PROMO_PA + off,
+                                           BENCH_DOMAIN, 0))->TEX = 0b011;
+    mmu_xlate_inval();
+    uint32_t upa;
+    int uf;
+    if(mmu_query(pt, PROMO_VA, &upa, &uf) != 4 * KB || FGET_MEM(uf) != MEM_UNKNOWN
+    || mmu_promote(pt, PROMO_VA, 64 * KB) != 0)
+        bad++;
+
+    // env_promote: a heap region filled in 64KB at a time.
+    kfree_all();
+    pt_alloc_reset();
+    env_init();
+    env_t *e = env_alloc();
+    vma_add(e, PROMO_VA, 2 * MB, VMA_HEAP, 0);
+    for(uint32_t off = 0; off < 2 * MB; off += 64 * KB)
+        env_map_lg_page(e, PROMO_VA + off, PROMO_PA + off, 0);
+    if(env_promote(e) != 2 || pt_stats().n_used != 0)
+        bad++;
+    uint32_t pa;
+    int flags;
+    if(mmu_query(e->pt, PROMO_VA + MB, &pa, &flags) != MB || pa != PROMO_PA + MB
+    || !(flags & F_NOT_GLOBAL))
+        bad++;
+    env_free(e);
+
+    if(bad) {
+        printk("ERROR: %u promotion checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// random 4KB/64KB/1MB allocations and frees, mostly small the way demand
+// paging asks. every frame must be aligned to its size and disjoint from the
+// others live, and freeing everything must merge back into 1MB blocks.
+#define FRAME_LIVE  1024
+#define FRAME_N     ((RAM_SIZE - FRAME_START) / (4 * KB))
+static void bench_frame(unsigned n) {
+    kfree_all();
+    pt_alloc_reset();
+    frame_init(FRAME_START, RAM_SIZE);
+
+    static uint32_t pa[FRAME_LIVE], sz[FRAME_LIVE];
+    memset(pa, 0, sizeof pa);
+    uint32_t seed = 0x2545f491;
+    unsigned bad = 0;
+    double s = now_ns();
+    for(unsigned i = 0; i < n; i++) {
+        unsigned j = xorshift(&seed) % FRAME_LIVE;
+        if(pa[j]) {
+            frame_free(pa[j], sz[j]);
+            pa[j] = 0;
+            continue;
+        }
+        unsigned r = xorshift(&seed) % 32;
+        sz[j] = r < 24 ? 4 * KB : r < 31 ? 64 * KB : MB;
+        pa[j] = frame_alloc(sz[j]);
+        bad += pa[j] % sz[j] != 0;
+    }
+    report("frame_alloc", n, now_ns() - s);
+
+    static uint8_t used[FRAME_N];
+    memset(used, 0, sizeof used);
+    for(unsigned j = 0; j < FRAME_LIVE; j++)
+        for(uint32_t off = 0; pa[j] && off < sz[j]; off += 4 * KB)
+            if(pa[j] < FRAME_START || used[(pa[j] + off - FRAME_START) / (4 * KB)]++)
+                bad++;
+    frame_stats_t st = frame_stats();
+    printk("%-16s %10u splits, %u merges, %u KB live\n", "",
+        st.n_splits, st.n_merges, (st.n_bytes - st.n_free) / KB);
+
+    for(unsigned j = 0; j < FRAME_LIVE; j++)
+        if(pa[j])
+            frame_free(pa[j], sz[j]);
+    st = frame_stats();
+    if(st.n_free != st.n_bytes || st.n_free_max != st.n_bytes / MB)
+        bad++;
+    // all of it, as 1MB frames, then nothing.
+    unsigned n_mb = 0;
+    while(frame_alloc(MB))
+        n_mb++;
+    if(n_mb != st.n_bytes / MB || frame_alloc(4 * KB))
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u frame allocator checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// the kernel layout of driver.c's VM_PART6, then pin it: vectors and text (a
+// section), both exception stacks (large pages) and the peripheral window (a
+// supersection) take four lockable entries, and only invalidate by MVA may
+// take them out again.
+static unsigned tlb_locked_n(void) {
+    unsigned n = 0;
+    for(int i = 0; i < 8; i++)
+        n += sim_cp15.tlb_locked[i].size != 0;
+    return n;
+}
+
+static void bench_tlb_lock(unsigned n) {
+    unsigned bad = 0;
+    fld_t *pt = fresh_pt();
+    mmu_map_section(pt, 0, 0, KERNEL_DOMAIN, 0);
+    mmu_map_lg_page(pt, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB,
+        SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
+    mmu_map_lg_page(pt, INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB,
+        INT_STACK_ADDR_FINE - ADDRESSES_PER_64KB, KERNEL_DOMAIN, 0);
+    mmu_map_range(pt, PERIPHERAL_BASE, PERIPHERAL_BASE, PERIPHERAL_SIZE, KERNEL_DOMAIN, 0);
+    use_pt(pt);
+
+    unsigned rounds = n / 256 + 1, nl = 0;
+    double s = now_ns();
+    for(unsigned i = 0; i < rounds; i++) {
+        nl = tlb_lock_kernel(pt);
+        tlb_unlock_all();
+    }
+    report("tlb_lock_kernel", rounds, now_ns() - s);
+
+    nl = tlb_lock_kernel(pt);
+    printk("%-16s %10u of %u lockable entries pin the kernel\n", "", nl, tlb_lock_avail());
+    if(nl != 4 || tlb_locked_n() != 4 || sim_cp15.tlb_locked[3].size != 16 * MB)
+        bad++;
+    // pinning again (or another address in a pinned mapping) is a no-op.
+    if(tlb_lock_kernel(pt) || tlb_lock(pt, 0x8000) != 0 || tlb_lock_used() != 4)
+        bad++;
+    // whole-TLB flushes leave locked entries alone; changing the mapping doesn't.
+    mmu_sync_pt();
+    mmu_protect(pt, INT_STACK_ADDR - 4, F_FULL_ACCESS);
+    if(tlb_locked_n() != 3)
+        bad++;
+    tlb_unlock_all();
+    if(tlb_locked_n() || tlb_lock_used() || sim_cp15.tlb_lockdown)
+        bad++;
+
+    if(bad) {
+        printk("ERROR: %u TLB lockdown checks failed\n", bad);
+        n_errors += bad;
+    }
+}
+
+// line counts of the range operations, their switch to the whole cache past
+// CACHE_RANGE_MAX, and the page table edits that now use them. the sim has no
+// cache to time: this checks the operations each path asks for.
+#define CACHE_CHECK(cond, msg) do { if(!(cond)) { printk("ERROR: cache: %s\n", msg); n_errors++; } } while(0)
+static void check_cache_ranges(void) {
+    static uint8_t buf[2 * CACHE_RANGE_MAX] __attribute__((aligned(CACHE_LINE)));
+    sim_cp15_t b = sim_cp15;
+
+    // [5, 100) touches lines 0..3.
+    cache_clean_range(buf + 5, buf + 100);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_mva - b.n_dcache_clean_mva == 4, "clean of 95 bytes is not 4 lines");
+    b = sim_cp15;
+    cache_clean_range(buf, buf + CACHE_RANGE_MAX);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_mva - b.n_dcache_clean_mva == CACHE_RANGE_MAX / CACHE_LINE
+        && sim_cp15.n_dcache_clean == b.n_dcache_clean, "clean of CACHE_RANGE_MAX is not by line");
+    b = sim_cp15;
+    cache_clean_range(buf, buf + CACHE_RANGE_MAX + 1);
+    CACHE_CHECK(sim_cp15.n_dcache_clean - b.n_dcache_clean == 1
+        && sim_cp15.n_dcache_clean_mva == b.n_dcache_clean_mva, "clean past CACHE_RANGE_MAX is not whole");
+
+    // partly covered lines are cleaned as well as invalidated, whole ones
+    // just invalidated.
+    b = sim_cp15;
+    cache_inv_range(buf + 5, buf + 100);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_inv_mva - b.n_dcache_clean_inv_mva == 2
+        && sim_cp15.n_dcache_inv_mva - b.n_dcache_inv_mva == 2, "inv of [5, 100) is not 2 + 2 lines");
+    b = sim_cp15;
+    cache_inv_range(buf + 40, buf + 50);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_inv_mva - b.n_dcache_clean_inv_mva == 1
+        && sim_cp15.n_dcache_inv_mva == b.n_dcache_inv_mva, "inv inside one line is not a clean+inv");
+    b = sim_cp15;
+    cache_inv_range(buf + 32, buf + 96);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_inv_mva == b.n_dcache_clean_inv_mva
+        && sim_cp15.n_dcache_inv_mva - b.n_dcache_inv_mva == 2, "inv of 2 whole lines cleaned them");
+    b = sim_cp15;
+    cache_inv_range(buf, buf + sizeof buf);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_inv - b.n_dcache_clean_inv == 1
+        && sim_cp15.n_dcache_inv_mva == b.n_dcache_inv_mva, "big inv is not a whole clean+inv");
+    b = sim_cp15;
+    cache_inv_range(buf + 8, buf + 8);
+    cache_clean_inv_range(buf + 8, buf + 8);
+    CACHE_CHECK(!memcmp(&b, &sim_cp15, sizeof b), "empty range did something");
+
+    // loading 4KB of code: its D lines out, its I lines and the BTB dropped.
+    b = sim_cp15;
+    cache_sync_code(buf, buf + 4096);
+    CACHE_CHECK(sim_cp15.n_dcache_clean_mva - b.n_dcache_clean_mva == 128
+        && sim_cp15.n_icache_inv_mva - b.n_icache_inv_mva == 128
+        && sim_cp15.n_icache_inv == b.n_icache_inv && sim_cp15.n_sync - b.n_sync == 1,
+        "code sync of 4KB is not 128 D + 128 I lines");
+    b = sim_cp15;
+    cache_icache_inv_range(buf, buf + sizeof buf);
+    CACHE_CHECK(sim_cp15.n_icache_inv - b.n_icache_inv == 1
+        && sim_cp15.n_icache_inv_mva == b.n_icache_inv_mva, "big I inv is not whole");
+}
+
+static void bench_cache(unsigned n) {
+    check_cache_ranges();
+
+    // map_range: 65 first-level entries (9 lines) and the coarse tables at
+    // the two unaligned ends (32 lines each); no whole-cache operation.
+    fld_t *pt = fresh_pt();
+    sim_cp15_t b = sim_cp15;
+    mmu_map_range(pt, RANGE_VA, RANGE_PA, RANGE_LEN, BENCH_DOMAIN, 0);
+    unsigned lines = sim_cp15.n_dcache_clean_mva - b.n_dcache_clean_mva;
+    printk("%-16s %10u D-cache lines cleaned by map_range (was the whole cache)\n", "", lines);
+    CACHE_CHECK(lines == 9 + 2 * 32 && sim_cp15.n_dcache_clean_inv == b.n_dcache_clean_inv
+        && sim_cp15.n_dcache_clean == b.n_dcache_clean && sim_cp15.n_tlb_inv - b.n_tlb_inv == 1,
+        "map_range did not clean just its descriptors");
+
+    // fork: both tables by line, then the parent's ASID.
+    env_setup();
+    env_t *p = env_alloc();
+    env_map_range(p, FORK_VA, FORK_PA, FORK_LEN, 0);
+    env_switch_to(p);
+    b = sim_cp15;
+    env_t *c = env_fork(p);
+    lines = sim_cp15.n_dcache_clean_mva - b.n_dcache_clean_mva;
+    printk("%-16s %10u D-cache lines cleaned by fork\n", "", lines);
+    CACHE_CHECK(lines && lines * CACHE_LINE <= 2 * CACHE_RANGE_MAX
+        && sim_cp15.n_dcache_clean_inv == b.n_dcache_clean_inv
+        && sim_cp15.n_dcache_clean == b.n_dcache_clean
+        && sim_cp15.last_inv_asid == p->asid, "fork did not clean just the tables");
+
+    // and the tables it cleaned are what the walk sees.
+    sim_xlate_t x;
+    env_switch_to(c);
+    CACHE_CHECK(sim_translate(FORK_VA, SIM_ACC_READ, &x) == SIM_OK && x.pa == FORK_PA,
+        "child does not map the parent's pages");
+    env_switch_to(p);
+    env_free(c);
+    mmu_disable();
+    env_free(p);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n = argc > 1 ? strtoul(argv[1], 0, 0) : 4 * MB;
+
+    sim_mem_init(SIM_RAM_SIZE, SIM_HEAP_START);
+    sim_cp15_reset();
+    mmu_init();
+
+    check_encoders();
+    bench_map_section(n);
+    bench_map_supersection(n);
+    bench_map_sm_page(n);
+    bench_map_lg_page(n);
+    bench_map_range(n);
+    bench_protect(n);
+    bench_pt_churn(n);
+    bench_lookup(n);
+    bench_translate(n);
+    bench_env_switch(n);
+    bench_domains(n);
+    bench_env_churn(n);
+    bench_fork(n);
+    bench_demand(n);
+    bench_dirty(n);
+    bench_age(n);
+    bench_swap(n);
+    bench_promote(n);
+    bench_cache(n);
+    bench_tlb_lock(n);
+    bench_frame(n);
+
+    if(n_errors) {
+        printk("FAILED: %u errors\n", n_errors);
+        return 1;
+    }
+    return 0;
+}
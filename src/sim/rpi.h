@@ -0,0 +1,73 @@
+/*
+ * Host stand-in for libpi's rpi.h
+ * ---
+ * Just enough of the libpi interface (printk, assert/demand, kmalloc) for the
+ * page-table code in src/ to compile and run as a normal unix program. Memory
+ * handed out by kmalloc lives in the simulated physical memory (sim-mem.c), so
+ * descriptors built by mmu.c hold real 32-bit physical addresses.
+ */
+#ifndef __RPI_H__
+#define __RPI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim-mem.h"
+
+// point mmu.c's physical address conversions at the simulated memory.
+#define mmu_pa_to_ptr(pa) sim_pa_to_ptr(pa)
+#define mmu_ptr_to_pa(p) sim_ptr_to_pa(p)
+#define mmu_va_to_ptr(va, pa) sim_pa_to_ptr(pa)
+
+// no format attribute, same as libpi: the pi code prints pointers with %x.
+int printk(const char *format, ...);
+
+void rpi_reboot(void) __attribute__((noreturn));
+void clean_reboot(void) __attribute__((noreturn));
+
+/*******************************************************************************
+ * simple memory allocation: a bump allocator over simulated physical memory.
+ */
+void *kmalloc_heap_end(void);
+void *kmalloc_heap_start(void);
+
+void kfree(void *p);
+void kfree_all(void);
+// returns 0-filled memory aligned to <alignment> bytes
+void *kmalloc_aligned(unsigned nbytes, unsigned alignment);
+// returns 0-filled memory.
+void *kmalloc(unsigned nbytes);
+
+// set where the heap starts (a simulated physical address).
+void kmalloc_set_start(unsigned _addr);
+
+/*******************************************************************************
+ * same error macros as libpi's assert.h, but they exit instead of rebooting.
+ */
+#define panic(msg, args...) do {                                        \
+    printk("PANIC:%s:%s:%d:" msg "\n", __FILE__, __FUNCTION__, __LINE__, ##args); \
+    rpi_reboot();                                                       \
+} while(0)
+
+#define assert(bool) do { if((bool) == 0) panic(#bool); } while(0)
+
+#define _XSTRING(x) #x
+
+#define demand(_expr, _msg) do {                                        \
+    if(!(_expr)) {                                                      \
+        printk("ERROR:%s:%s:%d: "                                       \
+                "FALSE(<" _XSTRING(_expr) ">): " _XSTRING(_msg) "\n",   \
+                __FILE__, __FUNCTION__, __LINE__);                      \
+        rpi_reboot();                                                   \
+    }                                                                   \
+} while(0)
+
+/* Compile-time assertion used in function. */
+#define AssertNow(x) switch(1) { case (x): case 0: ; }
+
+#define unimplemented() panic("implement this function!\n");
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * File: simulated cp15 operations
+ * ---
+ * Host versions of the routines vm-asm.S provides. Register reads and writes
+ * go to <sim_cp15>; cache and TLB maintenance has no effect on the simulated
+ * walk (there is no simulated TLB) so it is only counted.
+ */
+#include <time.h>
+
+#include "rpi.h"
+#include "mmu.h"
+#include "cp15-arm.h"
+#include "sim-cp15.h"
+#include "sim-walk.h"
+
+sim_cp15_t sim_cp15;
+
+// SBO bits of control reg 1 (see control_reg1_valid), everything else off.
+#define CTRL_REG1_RESET ((0b111 << 4) | (1 << 16) | (1 << 18))
+
+void sim_cp15_reset(void) {
+    memset(&sim_cp15, 0, sizeof sim_cp15);
+    sim_cp15.ctrl_reg1 = CTRL_REG1_RESET;
+}
+
+// host clock in 700MHz cycles.
+static uint32_t sim_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000000000ull + ts.tv_nsec) * 7 / 10);
+}
+
+/* registers */
+
+cp15_ctrl_reg1_t cp15_ctrl_reg1_rd(void) {
+    cp15_ctrl_reg1_t r;
+    AssertNow(sizeof r == 4);
+    memcpy(&r, &sim_cp15.ctrl_reg1, sizeof r);
+    return r;
+}
+uint32_t cp15_ctrl_reg1_rd_u32(void) { return sim_cp15.ctrl_reg1; }
+void cp15_ctrl_reg1_wr(cp15_ctrl_reg1_t r) {
+    memcpy(&sim_cp15.ctrl_reg1, &r, sizeof r);
+    sim_cp15.n_sync++;
+}
+
+cp15_tlb_reg_t cp15_ttbr0_rd(void) { return (cp15_tlb_reg_t){ .base = sim_cp15.ttbr0 }; }
+void cp15_ttbr0_wr(cp15_tlb_reg_t r) { sim_cp15.ttbr0 = r.base; }
+cp15_tlb_reg_t cp15_ttbr1_rd(void) { return (cp15_tlb_reg_t){ .base = sim_cp15.ttbr1 }; }
+void cp15_ttbr1_wr(cp15_tlb_reg_t r) { sim_cp15.ttbr1 = r.base; }
+
+uint32_t cp15_ttbr_ctrl_rd(void) { return sim_cp15.ttbr_ctrl; }
+void cp15_ttbr_ctrl_wr(uint32_t N) { sim_cp15.ttbr_ctrl = N; }
+
+uint32_t cp15_domain_ctrl_rd(void) { return sim_cp15.domain_ctrl; }
+void cp15_domain_ctrl_wr(uint32_t d) { sim_cp15.domain_ctrl = d; }
+
+uint32_t cp15_pmnc_rd(void) { return sim_cp15.pmnc & ~PMNC_CYCLE_RESET; }
+void cp15_pmnc_wr(uint32_t r) {
+    if(r & PMNC_CYCLE_RESET)
+        sim_cp15.cycle_base = sim_cycles();
+    sim_cp15.pmnc = r;
+}
+// a 700MHz pi's worth of host time; stopped while PMNC_ENABLE is clear.
+uint32_t cp15_cycle_cnt_rd(void) {
+    if(!(sim_cp15.pmnc & PMNC_ENABLE))
+        return 0;
+    uint32_t c = sim_cycles() - sim_cp15.cycle_base;
+    return sim_cp15.pmnc & PMNC_CYCLE_DIV64 ? c / 64 : c;
+}
+
+uint32_t cp15_procid_rd(void) { return sim_cp15.procid; }
+
+// arm1176: unified main TLB with 8 lockable entries.
+cp15_tlb_config_t cp15_tlb_config_rd(void) { return (cp15_tlb_config_t){ .n_d_lock = 8 }; }
+
+uint32_t cp15_tlb_lockdown_rd(void) { return sim_cp15.tlb_lockdown; }
+void cp15_tlb_lockdown_wr(uint32_t r) { sim_cp15.tlb_lockdown = r; sim_cp15.n_sync++; }
+
+// the walk the load in vm-asm.S would cause, landing in entry <victim>.
+void cp15_tlb_lock_mva(uint32_t mva, unsigned victim) {
+    sim_xlate_t x;
+    if(sim_translate(mva, SIM_ACC_READ, &x) != SIM_OK)
+        panic("locking unmapped va=0x%x: status 0b%u", mva, x.status);
+    assert(victim < 8);
+    sim_cp15.tlb_locked[victim].va = mva & ~(x.size - 1);
+    sim_cp15.tlb_locked[victim].size = x.size;
+    sim_cp15.tlb_lockdown = victim << 26;
+    sim_cp15.n_tlb_lock++;
+}
+
+// the c7 translate operation: the walk without the access, PA register out.
+uint32_t mmu_hw_translate(uint32_t va, unsigned mode, unsigned rw) {
+    sim_xlate_t x;
+    unsigned acc = (mode == HW_XLATE_USER ? SIM_ACC_USER : 0)
+                 | (rw == HW_XLATE_WRITE ? SIM_ACC_WRITE : 0);
+    if(sim_translate(va, acc, &x) != SIM_OK)
+        return (x.status & 0xF) << 1 | (x.status >> 4) << 5 | 1;
+    return x.pa & ~0x3FFu;
+}
+
+// same effect as the b2-25 sequence in vm-asm.S: ttbr1 is left alone.
+void cp15_set_procid_ttbr0(uint32_t procid, fld_t *pt) {
+    sim_cp15.ttbr0 = mmu_ptr_to_pa(pt);
+    sim_cp15.procid = procid;
+}
+
+/* page table stores */
+
+void mmu_desc_fill16(void *p, uint32_t d) {
+    uint32_t *e = p;
+    for(int i = 0; i < 16; i++)
+        e[i] = d;
+}
+
+/* barriers: nothing to wait for on the host. */
+
+void cp15_sync(void) { sim_cp15.n_sync++; }
+void cp15_barrier(void) { }
+void cp15_dsb(void) { }
+void cp15_dmb(void) { }
+void cp15_btb_flush(void) { }
+void cp15_prefetch_flush(void) { }
+
+/* cache and tlb maintenance */
+
+void cp15_caches_inv(void) { sim_cp15.n_icache_inv++; }
+void cp15_dcache_clean_inv(void) { sim_cp15.n_dcache_clean_inv++; sim_cp15.n_sync++; }
+void cp15_icache_inv(void) { sim_cp15.n_icache_inv++; sim_cp15.n_sync++; }
+void cp15_dcache_clean(void) { sim_cp15.n_dcache_clean++; sim_cp15.n_sync++; }
+
+// 32-byte lines overlapping [start, end), as the vm-asm.S loops walk them.
+// simulated RAM counts from its physical address: the host block holding it
+// is only 16-byte aligned.
+static uintptr_t sim_line_addr(const void *p) {
+    const uint8_t *b = p;
+    if(b >= sim_phys && b <= sim_phys + sim_phys_size)
+        return b - sim_phys;
+    return (uintptr_t)p;
+}
+static unsigned sim_lines(const void *start, const void *end) {
+    uintptr_t s = sim_line_addr(start), e = sim_line_addr(end);
+    assert(s < e);
+    return (e + 31) / 32 - s / 32;
+}
+void cp15_dcache_clean_lines(const void *start, const void *end) {
+    sim_cp15.n_dcache_clean_mva += sim_lines(start, end);
+}
+void cp15_dcache_inv_lines(const void *start, const void *end) {
+    sim_cp15.n_dcache_inv_mva += sim_lines(start, end);
+}
+void cp15_dcache_clean_inv_lines(const void *start, const void *end) {
+    sim_cp15.n_dcache_clean_inv_mva += sim_lines(start, end);
+}
+void cp15_icache_inv_lines(const void *start, const void *end) {
+    sim_cp15.n_icache_inv_mva += sim_lines(start, end);
+    sim_cp15.n_sync++;
+}
+
+void cp15_itlb_inv(void) { sim_cp15.n_tlb_inv++; }
+void cp15_dtlb_inv(void) { sim_cp15.n_tlb_inv++; }
+void cp15_tlbs_inv(void) { sim_cp15.n_tlb_inv++; sim_cp15.n_sync++; }
+// invalidate by MVA is the one operation that reaches locked entries.
+static void sim_tlb_inv_locked(uint32_t mva) {
+    for(int i = 0; i < 8; i++) {
+        uint32_t sz = sim_cp15.tlb_locked[i].size;
+        if(sz && (mva & ~(sz - 1)) == sim_cp15.tlb_locked[i].va)
+            sim_cp15.tlb_locked[i].size = 0;
+    }
+}
+
+void cp15_tlb_inv_mva(uint32_t mva) {
+    sim_tlb_inv_locked(mva);
+    sim_cp15.n_tlb_inv_mva++;
+    sim_cp15.n_sync++;
+}
+void cp15_tlb_inv_asid(uint32_t asid) {
+    sim_cp15.n_tlb_inv_mva++;
+    sim_cp15.n_sync++;
+    sim_cp15.last_inv_asid = asid;
+}
+
+void mmu_sync_pte_mod(fld_t *f, fld_t e) {
+    *f = e;
+    sim_cp15.n_dcache_clean_inv++;
+    sim_cp15.n_tlb_inv++;
+    sim_cp15.n_sync++;
+}
+
+void mmu_sync_pt(void) {
+    sim_cp15.n_dcache_clean_inv++;
+    sim_cp15.n_tlb_inv++;
+    sim_cp15.n_sync++;
+}
+
+void mmu_sync_tlb(void) {
+    sim_cp15.n_tlb_inv++;
+    sim_cp15.n_sync++;
+}
+
+void mmu_sync_pte_mva(void *pte, unsigned nbytes, uint32_t mva) {
+    sim_tlb_inv_locked(mva);
+    uintptr_t p = (uintptr_t)pte;
+    sim_cp15.n_dcache_clean_mva += ((p + nbytes + 31) / 32) - (p / 32);
+    sim_cp15.n_tlb_inv_mva++;
+    sim_cp15.n_sync++;
+}
+
+void mmu_reset(void) {
+    sim_cp15.n_icache_inv++;
+    sim_cp15.n_tlb_inv++;
+    sim_cp15.n_sync++;
+}
+
+void mmu_enable_set_asm(cp15_ctrl_reg1_t c) { cp15_ctrl_reg1_wr(c); }
+void mmu_disable_set_asm(cp15_ctrl_reg1_t c) {
+    sim_cp15.n_dcache_clean_inv++;
+    sim_cp15.n_icache_inv++;
+    cp15_ctrl_reg1_wr(c);
+}
@@ -0,0 +1,48 @@
+#ifndef __SIM_CP15_H__
+#define __SIM_CP15_H__
+
+/*
+ * Simulated cp15 state
+ * ---
+ * The registers vm-asm.S would read and write, kept in a plain struct so the
+ * translation walk can find the current tables and domain permissions. We
+ * also count the expensive maintenance operations so the benchmark can report
+ * how much flushing a given code path does.
+ */
+#include <stdint.h>
+
+typedef struct {
+    uint32_t ctrl_reg1,
+             ttbr0,
+             ttbr1,
+             ttbr_ctrl,     // N, b4-41
+             domain_ctrl,
+             procid,        // pid << 8 | asid
+             tlb_lockdown,  // victim << 26 | P
+             pmnc,          // performance monitor control
+             cycle_base;    // host cycles at the last cycle counter reset
+
+    // the arm1176's 8 lockable TLB entries: what each one maps, size 0 if empty.
+    struct { uint32_t va, size; } tlb_locked[8];
+
+    // maintenance operation counts.
+    unsigned n_tlb_inv,
+             n_tlb_inv_mva,     // single entry or single ASID
+             n_dcache_clean_inv,
+             n_dcache_clean,
+             n_dcache_clean_mva,    // lines, as are the other _mva ones
+             n_dcache_inv_mva,
+             n_dcache_clean_inv_mva,
+             n_icache_inv,
+             n_icache_inv_mva,
+             n_sync,
+             n_tlb_lock;
+    uint32_t last_inv_asid;     // of the last cp15_tlb_inv_asid
+} sim_cp15_t;
+
+extern sim_cp15_t sim_cp15;
+
+// power-on state: mmu off, all domains no access.
+void sim_cp15_reset(void);
+
+#endif
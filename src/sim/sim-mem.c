@@ -0,0 +1,79 @@
+/*
+ * File: simulated physical memory
+ * ---
+ * Backing store for the host simulator plus the libpi pieces mmu.c leans on:
+ * the kmalloc bump allocator (same semantics as cs140e-kmalloc.c, but carving
+ * from simulated physical memory) and reboot, which just exits.
+ */
+#include <stdarg.h>
+#include "rpi.h"
+
+#define roundup(x,n) (((x)+((n)-1))&(~((n)-1)))
+#define is_pow2(x)  (((x)&-(x)) == (x))
+
+uint8_t *sim_phys;
+uint32_t sim_phys_size;
+
+// heap pointers are simulated physical addresses.
+static uint32_t heap, heap_start;
+
+void sim_mem_init(uint32_t nbytes, uint32_t start) {
+    free(sim_phys);
+    // calloc of a big block is lazily zero-filled by the host, so untouched
+    // simulated RAM costs nothing.
+    sim_phys = calloc(1, nbytes);
+    if(!sim_phys)
+        panic("could not allocate %u bytes of simulated memory\n", nbytes);
+    sim_phys_size = nbytes;
+    kmalloc_set_start(start);
+}
+
+void sim_mem_oob(uint32_t pa) {
+    panic("physical address 0x%x outside simulated memory [0, 0x%x)\n",
+        pa, sim_phys_size);
+}
+
+int printk(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    return n;
+}
+
+void rpi_reboot(void) {
+    fflush(stdout);
+    exit(1);
+}
+void clean_reboot(void) {
+    printk("DONE!!!\n");
+    fflush(stdout);
+    exit(0);
+}
+
+void *kmalloc_heap_end(void) { return sim_pa_to_ptr(heap); }
+void *kmalloc_heap_start(void) { return sim_pa_to_ptr(heap_start); }
+
+void kmalloc_set_start(unsigned addr) {
+    heap = heap_start = addr;
+}
+
+void *kmalloc(unsigned sz) {
+    sz = roundup(sz, 8);
+    demand(heap + sz <= sim_phys_size, simulated heap exhausted);
+
+    void *addr = sim_pa_to_ptr(heap);
+    heap += sz;
+
+    memset(addr, 0, sz);
+    return addr;
+}
+
+void *kmalloc_aligned(unsigned nbytes, unsigned alignment) {
+    demand(is_pow2(alignment), assuming power of two);
+    heap = roundup(heap, alignment);
+    return kmalloc(nbytes);
+}
+
+void kfree(void *p) { }
+void kfree_all(void) { heap = heap_start; }
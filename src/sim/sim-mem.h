@@ -0,0 +1,40 @@
+#ifndef __SIM_MEM_H__
+#define __SIM_MEM_H__
+
+/*
+ * Simulated 32-bit physical memory
+ * ---
+ * A flat host buffer standing in for the pi's RAM: physical address <pa> lives
+ * at sim_phys[pa]. Page tables, coarse tables and frames all come out of this
+ * buffer so the translation walk (sim-walk.c) can follow descriptors exactly
+ * like the hardware does.
+ */
+#include <stdint.h>
+
+extern uint8_t *sim_phys;
+extern uint32_t sim_phys_size;
+
+// allocate <nbytes> of zeroed physical memory; heap starts at <heap_start>.
+void sim_mem_init(uint32_t nbytes, uint32_t heap_start);
+
+// any access outside simulated memory is a bug in the table builder.
+void sim_mem_oob(uint32_t pa) __attribute__((noreturn));
+
+static inline void *sim_pa_to_ptr(uint32_t pa) {
+    if(pa >= sim_phys_size)
+        sim_mem_oob(pa);
+    return sim_phys + pa;
+}
+
+static inline uint32_t sim_ptr_to_pa(const void *p) {
+    uintptr_t off = (const uint8_t *)p - sim_phys;
+    if(off >= sim_phys_size)
+        sim_mem_oob(~0);
+    return off;
+}
+
+static inline uint32_t sim_rd32(uint32_t pa) {
+    return *(uint32_t *)sim_pa_to_ptr(pa);
+}
+
+#endif
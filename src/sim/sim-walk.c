@@ -0,0 +1,113 @@
+/*
+ * File: software translation table walk
+ * ---
+ * Deliberately written with raw shifts and masks straight off the manual's
+ * descriptor diagrams rather than the bitfield structs in mmu.h: if mmu.c
+ * gets a field wrong, this walk should disagree with it.
+ */
+#include "rpi.h"
+#include "sim-cp15.h"
+#include "sim-walk.h"
+
+#define bits(x, lo, hi) (((x) >> (lo)) & ((1u << ((hi) - (lo) + 1)) - 1))
+#define bit(x, n) (((x) >> (n)) & 1)
+
+// domain access values in the DACR, b4-10
+#define DOM_NO_ACCESS   0b00
+#define DOM_CLIENT      0b01
+#define DOM_MANAGER     0b11
+
+// AP/APX check from the table on pg. B4-9 (XP=1, so S/R are ignored).
+static int ap_allows(unsigned apx, unsigned ap, unsigned acc) {
+    int user = (acc & SIM_ACC_USER) != 0,
+        write = (acc & SIM_ACC_WRITE) != 0;
+
+    if(!apx) {
+        switch(ap) {
+        case 0b00: return 0;
+        case 0b01: return !user;
+        case 0b10: return !user || !write;
+        case 0b11: return 1;
+        }
+    } else {
+        switch(ap) {
+        case 0b00: return 0;            // reserved
+        case 0b01: return !user && !write;
+        case 0b10:                      // deprecated encoding, same as 0b11
+        case 0b11: return !write;
+        }
+    }
+    return 0;
+}
+
+// first-level table for <va>: TTBR1 above the TTBR0 boundary if N > 0 (b4-41).
+static uint32_t first_level_base(uint32_t va) {
+    unsigned n = sim_cp15.ttbr_ctrl & 0b111;
+    if(n && (va >> (32 - n)))
+        return sim_cp15.ttbr1 & ~0x3fffu;
+    return sim_cp15.ttbr0 & ~((1u << (14 - n)) - 1);
+}
+
+// domain then permission check shared by every descriptor type.
+static unsigned check(sim_xlate_t *x, unsigned acc,
+        unsigned apx, unsigned ap, unsigned xn, int is_section) {
+    switch(bits(sim_cp15.domain_ctrl, 2*x->domain, 2*x->domain+1)) {
+    case DOM_MANAGER:
+        return x->status = SIM_OK;
+    case DOM_CLIENT:
+        break;
+    default:    // no access, reserved
+        return x->status = is_section ? SIM_FAULT_SECTION_DOM : SIM_FAULT_PAGE_DOM;
+    }
+    if(!ap_allows(apx, ap, acc) || ((acc & SIM_ACC_EXEC) && xn))
+        return x->status = is_section ? SIM_FAULT_SECTION_PERM : SIM_FAULT_PAGE_PERM;
+    return x->status = SIM_OK;
+}
+
+unsigned sim_translate(uint32_t va, unsigned acc, sim_xlate_t *x) {
+    memset(x, 0, sizeof *x);
+
+    uint32_t l1 = sim_rd32(first_level_base(va) + (va >> 20) * 4);
+
+    switch(l1 & 0b11) {
+    // section or supersection, b4-27
+    case 0b10:
+        if(bit(l1, 18)) {
+            x->size = 1 << 24;
+            x->domain = 0;  // supersections are always domain 0
+            x->pa = (l1 & 0xff000000) | (va & 0x00ffffff);
+        } else {
+            x->size = 1 << 20;
+            x->domain = bits(l1, 5, 8);
+            x->pa = (l1 & 0xfff00000) | (va & 0x000fffff);
+        }
+        x->not_global = bit(l1, 17);
+        return check(x, acc, bit(l1, 15), bits(l1, 10, 11), bit(l1, 4), 1);
+
+    // coarse page table, b4-30
+    case 0b01: {
+        x->domain = bits(l1, 5, 8);
+        uint32_t l2 = sim_rd32((l1 & 0xfffffc00) + bits(va, 12, 19) * 4);
+        x->not_global = bit(l2, 11);
+
+        switch(l2 & 0b11) {
+        case 0b00:
+            return x->status = SIM_FAULT_PAGE_XLATE;
+        // large page, b4-33
+        case 0b01:
+            x->size = 1 << 16;
+            x->pa = (l2 & 0xffff0000) | (va & 0xffff);
+            return check(x, acc, bit(l2, 9), bits(l2, 4, 5), bit(l2, 15), 0);
+        // small page (bit 0 is XN), b4-34
+        default:
+            x->size = 1 << 12;
+            x->pa = (l2 & 0xfffff000) | (va & 0xfff);
+            return check(x, acc, bit(l2, 9), bits(l2, 4, 5), bit(l2, 0), 0);
+        }
+    }
+
+    // fault, or the reserved (fine table) encoding.
+    default:
+        return x->status = SIM_FAULT_SECTION_XLATE;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef __SIM_WALK_H__
+#define __SIM_WALK_H__
+
+/*
+ * Software translation table walk
+ * ---
+ * Does what the ARM1176 table walk hardware does for a single access (see the
+ * flow chart on pg. B4-15 and the walks on B4-29 to B4-34): pick TTBR0/TTBR1
+ * using N, fetch the first-level descriptor, follow coarse tables to large and
+ * small pages, then apply the domain and AP/APX/XN checks. Runs off the
+ * simulated cp15 state, so set up TTBR0/domains first (e.g., env-style
+ * cp15_set_procid_ttbr0 + cp15_domain_ctrl_wr).
+ */
+#include <stdint.h>
+
+// access being translated; or these together.
+#define SIM_ACC_READ    0
+#define SIM_ACC_WRITE   (1 << 0)
+#define SIM_ACC_USER    (1 << 1)
+#define SIM_ACC_EXEC    (1 << 2)
+
+// fault status values, same encoding as WFAULT_STATUS (pg. B4-20).
+#define SIM_OK                  0
+#define SIM_FAULT_SECTION_XLATE 0b00101
+#define SIM_FAULT_PAGE_XLATE    0b00111
+#define SIM_FAULT_SECTION_DOM   0b01001
+#define SIM_FAULT_PAGE_DOM      0b01011
+#define SIM_FAULT_SECTION_PERM  0b01101
+#define SIM_FAULT_PAGE_PERM     0b01111
+
+typedef struct {
+    uint32_t pa;        // translated address (valid if status == SIM_OK)
+    unsigned status,    // SIM_OK or one of the SIM_FAULT_* values
+             domain,    // domain the descriptor was in
+             size,      // bytes mapped by the descriptor we ended at
+             not_global;    // nG: the TLB entry would be tagged with the ASID
+} sim_xlate_t;
+
+// translate <va> for access <acc>; returns x->status.
+unsigned sim_translate(uint32_t va, unsigned acc, sim_xlate_t *x);
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * File: compressed in-RAM swap
+ * ---
+ * See swap.h. Entries live in a fixed table, chained into hash buckets on
+ * (pid, va); the pool is a granule bitmap searched next-fit from where the
+ * last allocation ended. Everything is allocated by swap_init; with no pool
+ * (ents == 0) nothing is ever swapped out, so the rest never looks.
+ */
+#include "rpi.h"
+#include "cp15-arm.h"
+#include "mmu.h"
+#include "env.h"
+#include "vma.h"
+#include "frame.h"
+#include "cow.h"
+#include "dirty.h"
+#include "age.h"
+#include "lz.h"
+#include "swap.h"
+
+#define N_BUCKETS   1024
+#define NONE        0xffff
+
+typedef struct {
+    uint32_t pid,           // owner; 0 if the entry is free
+             va,            // start of the mapping
+             size;
+    int flags;              // as mmu_query
+    uint32_t gran,          // first pool granule
+             clen;          // compressed bytes; 0 for a zero page
+    uint16_t domain,
+             next;          // bucket chain, or free list
+} swap_ent_t;
+
+static swap_ent_t *ents;
+static uint16_t heads[N_BUCKETS], free_head;
+
+static uint8_t *pool, *scratch;
+static uint32_t *pool_used;
+static unsigned n_gran, cursor;
+
+static swap_stats_t stats;
+
+void swap_init(uint32_t pool_bytes) {
+    memset(&stats, 0, sizeof stats);
+    n_gran = pool_bytes / SWAP_GRANULE;
+    if (!n_gran) {
+        // off: anything allocated before is from a heap that's gone.
+        pool = scratch = 0;
+        pool_used = 0;
+        ents = 0;
+        return;
+    }
+    pool = kmalloc(n_gran * SWAP_GRANULE);
+    pool_used = kmalloc((n_gran + 31) / 32 * sizeof *pool_used);
+    memset(pool_used, 0, (n_gran + 31) / 32 * sizeof *pool_used);
+    cursor = 0;
+    // compress into this first: the result's size isn't known up front.
+    scratch = kmalloc(LG_PAGE_SIZE);
+
+    ents = kmalloc(SWAP_MAX_ENTRIES * sizeof *ents);
+    for (unsigned i = 0; i < SWAP_MAX_ENTRIES; i++) {
+        ents[i].pid = 0;
+        ents[i].next = i + 1 < SWAP_MAX_ENTRIES ? i + 1 : NONE;
+    }
+    free_head = 0;
+    for (unsigned i = 0; i < N_BUCKETS; i++)
+        heads[i] = NONE;
+}
+
+/* Pool */
+
+static inline int used(unsigned g) {
+    return pool_used[g / 32] >> (g % 32) & 1;
+}
+
+static void mark(unsigned g, unsigned k, int v) {
+    for (; k; k--, g++)
+        if (v)
+            pool_used[g / 32] |= 1u << (g % 32);
+        else
+            pool_used[g / 32] &= ~(1u << (g % 32));
+}
+
+// k free granules in a row, next-fit; -1 if there is no such run.
+static int pool_alloc(unsigned k) {
+    unsigned run = 0;
+    for (unsigned j = 0; j < n_gran + k; j++) {
+        unsigned g = (cursor + j) % n_gran;
+        // runs don't wrap around the end.
+        if (!g)
+            run = 0;
+        if (used(g)) {
+            run = 0;
+            continue;
+        }
+        if (++run == k) {
+            g -= k - 1;
+            mark(g, k, 1);
+            cursor = (g + k) % n_gran;
+            return g;
+        }
+    }
+    return -1;
+}
+
+static unsigned granules(uint32_t clen) {
+    return (clen + SWAP_GRANULE - 1) / SWAP_GRANULE;
+}
+
+/* Entries */
+
+static unsigned bucket(uint32_t pid, uint32_t va) {
+    return ((va / SM_PAGE_SIZE) ^ pid * 0x9e3779b1u) % N_BUCKETS;
+}
+
+// link to the entry of <e>'s mapping starting at <va>, 0 if none.
+static uint16_t *find(env_t *e, uint32_t va) {
+    uint16_t *p = &heads[bucket(e->pid, va)];
+    for (; *p != NONE; p = &ents[*p].next)
+        if (ents[*p].pid == e->pid && ents[*p].va == va)
+            return p;
+    return 0;
+}
+
+// unlink the entry at *p and give back its pool space.
+static void ent_free(env_t *e, uint16_t *p) {
+    unsigned i = *p;
+    swap_ent_t *s = &ents[i];
+    if (s->clen)
+        mark(s->gran, granules(s->clen), 0);
+    stats.n_entries--;
+    stats.bytes -= s->size;
+    stats.pool_bytes -= granules(s->clen) * SWAP_GRANULE;
+
+    *p = s->next;
+    s->pid = 0;
+    s->next = free_head;
+    free_head = i;
+    e->n_swapped--;
+}
+
+/* Out */
+
+static int all_zero(const uint32_t *p, unsigned n) {
+    for (unsigned i = 0; i < n / sizeof *p; i++)
+        if (p[i])
+            return 0;
+    return 1;
+}
+
+// vm_swap_out without the TLB flush for an env that isn't running.
+static int swap_out(env_t *e, uint32_t va) {
+    // only memory the env may write: then APX or a privileged-only AP on one
+    // of its pages is dirty tracking's or aging's, and vm_swap_fault can tell.
+    vma_t *v = vma_lookup(e, va);
+    if (!ents || !v || v->type == VMA_DEVICE
+    || FGET_AP(v->flags) != AP_FULL_ACCESS || FGET_APX(v->flags))
+        return 0;
+
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(e->pt, va, &pa, &flags);
+    // swapping in maps with these flags again, which a MEM_UNKNOWN type can't.
+    if ((sz != SM_PAGE_SIZE && sz != LG_PAGE_SIZE) || !FGET_NG(flags) || cow_sharers(pa)
+    || FGET_MEM(flags) == MEM_UNKNOWN)
+        return 0;
+    if (free_head == NONE) {
+        stats.n_rejected++;
+        return 0;
+    }
+    va &= ~(sz - 1);
+
+    uint32_t clen = 0;
+    int g = 0;
+    const uint8_t *src = frame_kmap(pa, sz);
+    if (!all_zero((const uint32_t *)src, sz)) {
+        // has to save at least an eighth to be worth a fault later.
+        clen = lz_compress(src, sz, scratch, sz - sz / 8);
+        if (!clen || (g = pool_alloc(granules(clen))) < 0) {
+            frame_kunmap();
+            stats.n_rejected++;
+            return 0;
+        }
+        memcpy(pool + g * SWAP_GRANULE, scratch, clen);
+    }
+    frame_kunmap();
+
+    unsigned i = free_head;
+    swap_ent_t *s = &ents[i];
+    free_head = s->next;
+    s->pid = e->pid;
+    s->va = va;
+    s->size = sz;
+    s->flags = flags;
+    s->gran = g;
+    s->clen = clen;
+    // the coarse table may go with the last page in it.
+    s->domain = mmu_lookup(e->pt, va)->domain;
+    uint16_t *head = &heads[bucket(e->pid, va)];
+    s->next = *head;
+    *head = i;
+
+    mmu_unmap(e->pt, va);
+    frame_release(pa, sz);
+    v->committed -= sz;
+    e->n_swapped++;
+
+    stats.n_out++;
+    stats.n_zero += !clen;
+    stats.n_entries++;
+    stats.bytes += sz;
+    stats.pool_bytes += granules(clen) * SWAP_GRANULE;
+    return 1;
+}
+
+// mmu_unmap only drops TLB entries under the running ASID.
+static void swap_flush(env_t *e) {
+    if (e != curr_env)
+        cp15_tlb_inv_asid(e->asid);
+}
+
+int vm_swap_out(env_t *e, uint32_t va) {
+    int ok = swap_out(e, va);
+    if (ok)
+        swap_flush(e);
+    return ok;
+}
+
+uint32_t vm_swap_cold(env_t *e, uint32_t bytes) {
+    uint32_t freed = 0;
+    if (!ents)
+        return 0;
+    for (unsigned i = 0; i < e->n_vma && freed < bytes; i++) {
+        vma_t *v = &e->vma[i];
+        if (v->type == VMA_DEVICE)
+            continue;
+        for (uint32_t va = v->start; va < v->end && freed < bytes; ) {
+            uint32_t pa;
+            int flags;
+            unsigned sz;
+            if (!mmu_lookup(e->pt, va))
+                sz = SECTION_SIZE;
+            else if (!(sz = mmu_query(e->pt, va, &pa, &flags)))
+                sz = SM_PAGE_SIZE;
+            else if (vm_age_cold(e, va) && swap_out(e, va))
+                freed += sz;
+            va = (va & ~(sz - 1)) + sz;
+        }
+    }
+    if (freed)
+        swap_flush(e);
+    return freed;
+}
+
+/* In */
+
+// map the entry's page back into <e>; 0 if there's no frame for it.
+static int swap_in(env_t *e, uint16_t *p) {
+    swap_ent_t *s = &ents[*p];
+    uint32_t pa = frame_alloc(s->size);
+    if (!pa)
+        return 0;
+    uint8_t *dst = frame_kmap(pa, s->size);
+    if (!s->clen)
+        memset(dst, 0, s->size);
+    else if (!lz_decompress(pool + s->gran * SWAP_GRANULE, s->clen, dst, s->size))
+        panic("swap entry for va=%x is corrupt\n", s->va);
+    frame_kunmap();
+
+    // a tracker that let go of the page while it was out (vm_dirty_untrack,
+    // vm_age_stop) won't take back the fault it would cause.
+    int flags = s->flags;
+    if ((flags & 0b111) == F_NO_USR_ACCESS && !vm_age_hidden(e, s->va))
+        flags = (flags & ~0b111) | F_FULL_ACCESS;
+    if ((flags & F_SET_APX) && !vm_dirty_protected(e, s->va))
+        flags &= ~F_SET_APX;
+
+    uint32_t va = s->va;
+    if (s->size == LG_PAGE_SIZE)
+        mmu_map_lg_page(e->pt, va, pa, s->domain, flags);
+    else
+        mmu_map_sm_page(e->pt, va, pa, s->domain, flags);
+    mmu_sync_map(e->pt, va);
+    vma_lookup(e, va)->committed += s->size;
+    ent_free(e, p);
+
+    if (!(flags & F_SET_APX))
+        vm_dirty_mark(e, va);
+    stats.n_in++;
+    return 1;
+}
+
+int vm_swap_fault(env_t *e, uint32_t va) {
+    if (!e->n_swapped || va >= ENV_VA_LIMIT)
+        return 0;
+    uint32_t start = cp15_cycle_cnt_rd();
+
+    // the mapping is a small page or the large page around it.
+    uint16_t *p = find(e, va & ~(SM_PAGE_SIZE - 1));
+    if (!p)
+        p = find(e, va & ~(LG_PAGE_SIZE - 1));
+    if (!p || (ents[*p].size == SM_PAGE_SIZE && ents[*p].va != (va & ~(SM_PAGE_SIZE - 1))))
+        return 0;
+    if (!swap_in(e, p))
+        return 0;
+
+    uint32_t cycles = cp15_cycle_cnt_rd() - start;
+    stats.in_cycles += cycles;
+    if (cycles > stats.in_max_cycles)
+        stats.in_max_cycles = cycles;
+    return 1;
+}
+
+void vm_swap_release(env_t *e) {
+    for (unsigned b = 0; b < N_BUCKETS && e->n_swapped; b++)
+        for (uint16_t *p = &heads[b]; *p != NONE; )
+            if (ents[*p].pid != e->pid)
+                p = &ents[*p].next;
+            else if (!swap_in(e, p))
+                panic("no frames to swap pid %d back in\n", e->pid);
+}
+
+void vm_swap_drop(env_t *e) {
+    for (unsigned b = 0; b < N_BUCKETS && e->n_swapped; b++)
+        for (uint16_t *p = &heads[b]; *p != NONE; )
+            if (ents[*p].pid != e->pid)
+                p = &ents[*p].next;
+            else
+                ent_free(e, p);
+}
+
+swap_stats_t swap_stats(void) {
+    return stats;
+}
+
+void swap_stats_dump(void) {
+    printk("swap: %d out (%d zero, %d rejected), %d in, %d live\n",
+        stats.n_out, stats.n_zero, stats.n_rejected, stats.n_in, stats.n_entries);
+    printk("  %d KB held in %d KB of pool", stats.bytes / 1024, stats.pool_bytes / 1024);
+    // zero pages take no pool at all.
+    if (stats.pool_bytes)
+        printk(", %d:1", stats.bytes / stats.pool_bytes);
+    printk("\n");
+    // in units of 1024 cycles, as fault-stats.c: no 64-bit division.
+    printk("  fault-in: %d Kcycles total, %d cycles max\n",
+        (unsigned)(stats.in_cycles >> 10), stats.in_max_cycles);
+}
@@ -0,0 +1,69 @@
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+/*
+ * Compressed in-RAM swap
+ * ---
+ * There's no swap device, so cold pages are compressed (lz.h) into a pool in
+ * kernel memory and their frames go back to frame.c. vm_swap_out unmaps the
+ * page, so its next access takes a translation fault. data_abort_fast offers
+ * that fault to vm_swap_fault before vma_fault, and vm_swap_fault gets a new
+ * frame, decompresses into it and maps it back with its old flags. Pages that
+ * are all zero only take an entry. Pages that don't compress to 7/8 of their
+ * size stay resident.
+ *
+ * The unit is one mapping: a 4KB page, or a 64KB large page (16 cold 4KB
+ * pages, compressed as one block), since that is how ANON and HEAP regions
+ * are committed. Sections, device regions and pages shared copy-on-write are
+ * never swapped. Pool space is handed out in SWAP_GRANULE pieces.
+ *
+ * Swap is opt-in (swap_init). env_fork swaps the parent back in first (vm_swap_release); env_free drops
+ * the env's entries (vm_swap_drop). A page that comes back writable while its
+ * env is dirty tracked is marked dirty: tracking never saw it go.
+ */
+#include <stdint.h>
+#include "env.h"
+
+#define SWAP_POOL_SIZE      (2 * 1024 * 1024)
+#define SWAP_GRANULE        64
+#define SWAP_MAX_ENTRIES    4096
+
+// swap is off until this is called with a pool size (SWAP_POOL_SIZE, say):
+// the pool and entries come from kmalloc, about 180KB on top of the pool, so
+// the heap the kernel maps has to hold them. call it after env_init, which
+// turns swap back off (swap_init(0)) since the heap starts over.
+void swap_init(uint32_t pool_bytes);
+
+// compress the mapping covering <va> out of <e>: 1 if it went, 0 if it can't
+// (not a private 4KB/64KB page in a writable region, incompressible, pool or
+// entries full).
+int vm_swap_out(env_t *e, uint32_t va);
+
+// swap out mappings page aging (age.h) finds cold until <bytes> of frames are
+// freed; returns the bytes freed.
+uint32_t vm_swap_cold(env_t *e, uint32_t bytes);
+
+// a translation fault at <va>: 1 if it was swapped out (it is back: retry the
+// access), 0 otherwise.
+int vm_swap_fault(env_t *e, uint32_t va);
+
+// swap everything of <e> back in; drop it without swapping in.
+void vm_swap_release(env_t *e);
+void vm_swap_drop(env_t *e);
+
+typedef struct {
+    unsigned n_out,
+             n_zero,        // of n_out: all zero, no pool space
+             n_rejected,    // didn't compress well enough, or no room
+             n_in,
+             n_entries;     // live
+    uint32_t bytes,         // live, uncompressed
+             pool_bytes;    // live, in the pool (granule rounded)
+    uint64_t in_cycles;     // total fault-in time
+    uint32_t in_max_cycles;
+} swap_stats_t;
+
+swap_stats_t swap_stats(void);
+void swap_stats_dump(void);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * File: TLB lockdown
+ * ---
+ * Pins hot kernel translations in the lockable TLB entries; see tlb-lock.h.
+ * The lock itself (lockdown register dance plus the load that causes the walk)
+ * is cp15_tlb_lock_mva in vm-asm.S.
+ */
+#include "rpi.h"
+#include "mmu.h"
+#include "cp15-arm.h"
+#include "helper-macros.h"
+#include "memmap-constants.h"
+#include "tlb-lock.h"
+
+// GPFSEL0: in the same window as the UART, and reading it has no side effects.
+#define GPIO_FSEL0  (PERIPHERAL_BASE + 0x200000)
+
+// start and size of each pinned mapping.
+static struct { uint32_t va, size; } locked[TLB_LOCK_MAX];
+static unsigned n_locked;
+
+unsigned tlb_lock_avail(void) {
+    unsigned n = cp15_tlb_config_rd().n_d_lock;
+    return n < TLB_LOCK_MAX ? n : TLB_LOCK_MAX;
+}
+
+unsigned tlb_lock_used(void) {
+    return n_locked;
+}
+
+unsigned tlb_lock(fld_t *pt, uint32_t va) {
+    uint32_t pa;
+    int flags;
+    unsigned sz = mmu_query(pt, va, &pa, &flags);
+    demand(sz, va not mapped);
+    demand(!(flags & F_NOT_GLOBAL), only global mappings can be pinned);
+
+    // already pinned: locking it again would invalidate the locked entry.
+    va &= ~(sz - 1);
+    for (unsigned i = 0; i < n_locked; i++)
+        if (locked[i].va == va && locked[i].size == sz)
+            return i;
+
+    demand(n_locked < tlb_lock_avail(), out of lockable TLB entries);
+    cp15_tlb_lock_mva(va, n_locked);
+    locked[n_locked].va = va;
+    locked[n_locked].size = sz;
+    return n_locked++;
+}
+
+unsigned tlb_lock_range(fld_t *pt, uint32_t va, uint32_t len) {
+    demand(is_aligned(va | len, SM_PAGE_SIZE), range must be 4KB aligned);
+
+    unsigned n = 0;
+    uint32_t end = va + len;
+    while (va < end) {
+        uint32_t pa;
+        int flags;
+        unsigned sz = mmu_query(pt, va, &pa, &flags), used = n_locked;
+        if (sz) {
+            tlb_lock(pt, va);
+            n += n_locked - used;
+        } else
+            sz = SM_PAGE_SIZE;
+        // next mapping: mappings are aligned to their size.
+        uint32_t next = (va & ~(sz - 1)) + sz;
+        if (next < va)
+            break;
+        va = next;
+    }
+    return n;
+}
+
+unsigned tlb_lock_kernel(fld_t *pt) {
+    // vectors at 0 and the kernel image, which ends below the SWI stack.
+    unsigned used = n_locked;
+    tlb_lock_range(pt, 0, SWI_STACK_ADDR_FINE - ADDRESSES_PER_64KB);
+    tlb_lock(pt, INT_STACK_ADDR - 4);
+    tlb_lock(pt, SWI_STACK_ADDR - 4);
+    tlb_lock(pt, GPIO_FSEL0);
+    return n_locked - used;
+}
+
+void tlb_unlock_all(void) {
+    cp15_tlb_lockdown_wr(0);
+    for (unsigned i = 0; i < n_locked; i++)
+        cp15_tlb_inv_mva(locked[i].va);
+    n_locked = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef __TLB_LOCK_H__
+#define __TLB_LOCK_H__
+
+/*
+ * Pinning translations in the TLB
+ * ---
+ * The arm1176 main TLB has a few lockable entries (n_d_lock in the TLB type
+ * register, b4-39). A translation walked into one of them with the lockdown
+ * register's P bit set stays there: INV_TLB (c8,c7,0) and ASID invalidates
+ * skip locked entries, so user code thrashing the TLB can't evict it. Only an
+ * invalidate by MVA removes it.
+ *
+ * We use them for what every exception and printk touches: the vector page and
+ * kernel text, the exception stacks, and the GPIO/UART window. Each lock pins
+ * the one mapping (section, large page, ...) covering the address, so big
+ * kernel mappings go a long way. Only global mappings can be pinned: a locked
+ * non-global entry would match a single ASID.
+ *
+ * Changing a pinned mapping with mmu_unmap/remap/protect drops its entry (they
+ * invalidate by MVA); the slot stays taken until tlb_unlock_all.
+ */
+#include "mmu.h"
+
+#define TLB_LOCK_MAX 8
+
+// pin the mapping covering <va> in <pt>, which must be the live table. returns
+// the lockable entry used.
+unsigned tlb_lock(fld_t *pt, uint32_t va);
+
+// pin every mapping in [va, va+len); unmapped holes are skipped. returns the
+// number of entries used.
+unsigned tlb_lock_range(fld_t *pt, uint32_t va, uint32_t len);
+
+// pin the kernel's vectors and text, exception stacks and the GPIO/UART window.
+unsigned tlb_lock_kernel(fld_t *pt);
+
+// drop every pinned entry and free the lockable entries.
+void tlb_unlock_all(void);
+
+// lockable entries in use / available.
+unsigned tlb_lock_used(void);
+unsigned tlb_lock_avail(void);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * File: per-env memory regions
+ * ---
+ * Regions are kept sorted by address in a small array in the env; with a
+ * handful of regions a linear scan beats anything cleverer.
+ */
+#include "rpi.h"
+#include "mmu.h"
+#include "env.h"
+#include "vma.h"
+#include "frame.h"
+
+static vma_t *vma_insert(env_t *e, uint32_t va, uint32_t len, unsigned type, int flags) {
+    demand(len && (va | len) % SM_PAGE_SIZE == 0, region must be page aligned);
+    demand(va + len > va, region wraps around);
+    demand(va + len <= ENV_VA_LIMIT, region runs into the kernel half);
+    demand(e->n_vma < ENV_MAX_VMA, too many regions);
+
+    unsigned i;
+    for (i = 0; i < e->n_vma && e->vma[i].start < va; i++)
+        ;
+    demand(i == 0 || e->vma[i-1].end <= va, overlaps the region below);
+    demand(i == e->n_vma || va + len <= e->vma[i].start, overlaps the region above);
+
+    memmove(&e->vma[i+1], &e->vma[i], (e->n_vma - i) * sizeof e->vma[0]);
+    e->n_vma++;
+
+    vma_t *v = &e->vma[i];
+    memset(v, 0, sizeof *v);
+    v->start = va;
+    v->end = va + len;
+    v->type = type;
+    v->flags = flags;
+    return v;
+}
+
+vma_t *vma_add(env_t *e, uint32_t va, uint32_t len, unsigned type, int flags) {
+    demand(type == VMA_ANON || type == VMA_HEAP || type == VMA_STACK, use vma_add_device);
+    return vma_insert(e, va, len, type, flags);
+}
+
+vma_t *vma_add_device(env_t *e, uint32_t va, uint32_t pa, uint32_t len, int flags) {
+    vma_t *v = vma_insert(e, va, len, VMA_DEVICE, flags);
+    v->pa = pa;
+    return v;
+}
+
+vma_t *vma_lookup(env_t *e, uint32_t va) {
+    for (unsigned i = 0; i < e->n_vma && e->vma[i].start <= va; i++)
+        if (va < e->vma[i].end)
+            return &e->vma[i];
+    return 0;
+}
+
+// sizing policy: how much to commit around va (see vma.h).
+static uint32_t vma_page_size(vma_t *v, uint32_t va) {
+    if (v->type == VMA_STACK)
+        return SM_PAGE_SIZE;
+    uint32_t lg = va & ~(LG_PAGE_SIZE - 1);
+    if (lg >= v->start && lg + LG_PAGE_SIZE <= v->end)
+        return LG_PAGE_SIZE;
+    return SM_PAGE_SIZE;
+}
+
+int vma_fault(env_t *e, uint32_t va) {
+    vma_t *v = vma_lookup(e, va);
+    if (!v)
+        return 0;
+
+    if (v->type == VMA_DEVICE) {
+        env_map_range(e, v->start, v->pa, v->end - v->start, v->flags);
+        v->committed = v->end - v->start;
+        return 1;
+    }
+
+    uint32_t sz = vma_page_size(v, va),
+             page = va & ~(sz - 1);
+    uint32_t pa = frame_alloc(sz);
+    if (!pa)
+        return 0;
+    // fresh anonymous memory must read as zero.
+    memset(frame_kmap(pa, sz), 0, sz);
+    frame_kunmap();
+
+    if (sz == LG_PAGE_SIZE)
+        env_map_lg_page(e, page, pa, v->flags);
+    else
+        env_map_sm_page(e, page, pa, v->flags);
+    // the retried access walks the table: RAM is cacheable (MEM_DEFAULT).
+    mmu_sync_map(e->pt, page);
+    v->committed += sz;
+    return 1;
+}
+
+uint32_t vma_committed(env_t *e) {
+    uint32_t n = 0;
+    for (unsigned i = 0; i < e->n_vma; i++)
+        n += e->vma[i].committed;
+    return n;
+}
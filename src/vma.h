@@ -0,0 +1,56 @@
+#ifndef __VMA_H__
+#define __VMA_H__
+
+/*
+ * Per-env memory regions and demand paging
+ * ---
+ * An env's user address space is a short list of regions: reserving one only
+ * records it, nothing is mapped or allocated. The first touch of a page takes
+ * a translation fault, data_abort_vector hands it to vma_fault, and the region
+ * decides how much to commit:
+ *
+ *  - VMA_STACK: 4KB pages, since stacks are touched one page at a time.
+ *  - VMA_HEAP, VMA_ANON: 64KB large pages (one fault and one TLB entry per
+ *    16 pages) where the 64KB block fits in the region, 4KB at ragged edges.
+ *  - VMA_DEVICE: the whole region at once, identity offset onto <pa>, with
+ *    the biggest pages mmu_map_range can use.
+ *
+ * Backing frames come from frame.c, are zero-filled and mapped non-global in
+ * the env's domain; env_free gives them back.
+ */
+#include "mmu.h"
+
+enum {
+    VMA_ANON = 1,
+    VMA_HEAP,
+    VMA_STACK,
+    VMA_DEVICE,
+};
+
+typedef struct vma {
+    uint32_t start, end;    // [start, end)
+    unsigned type;
+    int flags;              // mmu_map_* flags for the pages (F_NOT_GLOBAL implied)
+    uint32_t pa;            // VMA_DEVICE: physical address of <start>
+    uint32_t committed;     // bytes of frames mapped so far
+} vma_t;
+
+#define ENV_MAX_VMA 8
+
+struct env;
+
+// reserve [va, va+len) in <e>. va and len must be 4KB aligned.
+vma_t *vma_add(struct env *e, uint32_t va, uint32_t len, unsigned type, int flags);
+vma_t *vma_add_device(struct env *e, uint32_t va, uint32_t pa, uint32_t len, int flags);
+
+// region covering <va>, or 0.
+vma_t *vma_lookup(struct env *e, uint32_t va);
+
+// commit the page covering <va> after a translation fault: returns 1 if a
+// region covers it (retry the access), 0 if not or if frames ran out.
+int vma_fault(struct env *e, uint32_t va);
+
+// bytes committed across all of <e>'s regions.
+uint32_t vma_committed(struct env *e);
+
+#endif